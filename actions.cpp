@@ -0,0 +1,84 @@
+#include "actions.hpp"
+
+using namespace std;
+
+void startActionQueue(ActionQueue *queue, int capacity) {
+	uint32 size = 1;
+	while (size < (uint32)capacity) {
+		size *= 2;
+	}
+	queue->cells = new ActionQueueCell[size];
+	queue->mask = size - 1;
+	for (uint32 i = 0; i < size; ++i) {
+		queue->cells[i].sequence.store(i, memory_order_relaxed);
+	}
+	queue->tail.store(0, memory_order_relaxed);
+	queue->head.store(0, memory_order_relaxed);
+}
+
+void stopActionQueue(ActionQueue *queue) {
+	delete[] queue->cells;
+	queue->cells = NULL;
+}
+
+bool pushAction(ActionQueue *queue, const Action *action) {
+	ActionQueueCell *cell;
+	uint32 pos = queue->tail.load(memory_order_relaxed);
+	while (true) {
+		cell = &queue->cells[pos & queue->mask];
+		uint32 sequence = cell->sequence.load(memory_order_acquire);
+		int32 diff = (int32)(sequence - pos);
+		if (diff == 0) {
+			// the cell is free, try to claim it
+			if (queue->tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// the cell still holds an action from one round earlier
+			return false;
+		} else {
+			pos = queue->tail.load(memory_order_relaxed);
+		}
+	}
+	cell->action = *action;
+	cell->sequence.store(pos + 1, memory_order_release);
+	return true;
+}
+
+bool popAction(ActionQueue *queue, Action *action) {
+	ActionQueueCell *cell;
+	uint32 pos = queue->head.load(memory_order_relaxed);
+	while (true) {
+		cell = &queue->cells[pos & queue->mask];
+		uint32 sequence = cell->sequence.load(memory_order_acquire);
+		int32 diff = (int32)(sequence - (pos + 1));
+		if (diff == 0) {
+			// the cell is filled, try to claim it
+			if (queue->head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = queue->head.load(memory_order_relaxed);
+		}
+	}
+	*action = cell->action;
+	// hand the cell to the producer of the next round
+	cell->sequence.store(pos + queue->mask + 1, memory_order_release);
+	return true;
+}
+
+int countActions(const ActionQueue *queue) {
+	uint32 head = queue->head.load(memory_order_relaxed);
+	uint32 tail = queue->tail.load(memory_order_relaxed);
+	// claimed but not yet filled cells count as well
+	int32 count = (int32)(tail - head);
+	return count > 0 ? count : 0;
+}
+
+int popActions(ActionQueue *queue, Action *actions, int max_count) {
+	int count = 0;
+	while (count < max_count && popAction(queue, &actions[count])) {
+		++count;
+	}
+	return count;
+}
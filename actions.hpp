@@ -0,0 +1,55 @@
+#ifndef ACTIONS_HPP_
+#define ACTIONS_HPP_
+
+#include "std_types.hpp"
+
+#include <atomic>
+
+// Typed player actions. Human input, bots and load tests all push them into
+// an ActionQueue, the game loop takes them out in batches right before a tick
+// so that every action takes effect at a well defined tick.
+
+#define ACTION_TURN_ROTOR   1
+#define ACTION_RELEASE_BALL 2
+#define ACTION_RESET        3
+#define ACTION_SPAWN_BALL   4
+
+struct Action {
+	int32 type;
+	// rotor index, or spawn index for ACTION_SPAWN_BALL
+	int32 target;
+	// direction, rotor position or ball type
+	int32 argument;
+};
+
+struct ActionQueueCell {
+	std::atomic<uint32> sequence;
+	Action action;
+};
+
+// Bounded lock-free queue for any number of producers and consumers. Every
+// cell carries a sequence number that tells whose turn it is, so producers
+// and consumers only contend on their own end of the queue.
+struct ActionQueue {
+	ActionQueueCell *cells;
+	uint32 mask;
+	byte padding_1[64];
+	std::atomic<uint32> tail;
+	byte padding_2[64];
+	std::atomic<uint32> head;
+	byte padding_3[64];
+};
+
+// capacity is rounded up to a power of two
+void startActionQueue(ActionQueue *, int capacity);
+void stopActionQueue(ActionQueue *);
+// false if the queue is full
+bool pushAction(ActionQueue *, const Action *);
+// false if the queue is empty
+bool popAction(ActionQueue *, Action *);
+// take up to max_count actions out at once, returns how many
+int popActions(ActionQueue *, Action *actions, int max_count);
+// only a snapshot while other threads push or pop
+int countActions(const ActionQueue *);
+
+#endif // ACTIONS_HPP_
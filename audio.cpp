@@ -0,0 +1,201 @@
+#include "logical.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Sound effects for game events.
+//
+// The samples are made up once at start into one pool. The game thread
+// turns the events of every tick into sound numbers and hands them to the
+// mixer through a single-producer single-consumer queue. The mixer runs in
+// SDL's audio callback: it takes new sounds off the queue, mixes every voice
+// that is playing into the buffer and never locks or allocates.
+
+#define AUDIO_FREQUENCY 48000
+// sounds started at once, the oldest voice makes room for a new one
+#define AUDIO_VOICES 16
+// power of two
+#define AUDIO_QUEUE_SIZE 256
+
+struct SoundSample {
+	int offset;
+	int length;
+};
+
+struct AudioVoice {
+	const int16 *samples;
+	int length;
+	int position;
+	uint32 started;
+};
+
+// game thread writes tail, mixer writes head
+struct SoundQueue {
+	int32 sounds[AUDIO_QUEUE_SIZE];
+	byte padding_1[64];
+	atomic<uint32> tail;
+	byte padding_2[64];
+	atomic<uint32> head;
+};
+
+static SDL_AudioDeviceID audio_device = 0;
+static vector<int16> sample_pool;
+static SoundSample sound_samples[SOUND_COUNT];
+static SoundQueue sound_queue;
+static EventCursor audio_events;
+
+// only touched by the mixer
+static AudioVoice voices[AUDIO_VOICES];
+static uint32 voices_started = 0;
+static int32 mix_buffer[8192];
+
+// a decaying tone from frequency_start to frequency_end with a little noise
+static void makeSound(int sound, float seconds_long, float frequency_start, float frequency_end, float noise, float volume) {
+	int length = (int)(seconds_long * AUDIO_FREQUENCY);
+	sound_samples[sound].offset = (int)sample_pool.size();
+	sound_samples[sound].length = length;
+	Random random;
+	random_seed(&random, sound + 1);
+	double phase = 0;
+	for (int i = 0; i < length; ++i) {
+		float t = (float)i / length;
+		float frequency = frequency_start + (frequency_end - frequency_start) * t;
+		phase += 2 * 3.14159265358979 * frequency / AUDIO_FREQUENCY;
+		float white = (random_get(&random) % 2001) / 1000.0f - 1.0f;
+		float value = ((1 - noise) * (float)sin(phase) + noise * white) * (1 - t) * (1 - t);
+		// a few samples of fade-in against clicks
+		value *= SDL_min(i / 48.0f, 1.0f);
+		sample_pool.push_back((int16)(value * volume * 32767));
+	}
+}
+
+static void mixAudio(void *, Uint8 *stream, int size) {
+	int16 *out = (int16 *)stream;
+	int frames = SDL_min(size / (int)sizeof(int16), (int)(sizeof(mix_buffer) / sizeof(mix_buffer[0])));
+
+	// start what the game asked for
+	uint32 head = sound_queue.head.load(memory_order_relaxed);
+	uint32 tail = sound_queue.tail.load(memory_order_acquire);
+	for (; head != tail; ++head) {
+		int sound = sound_queue.sounds[head % AUDIO_QUEUE_SIZE];
+		AudioVoice *voice = &voices[0];
+		for (int i = 0; i < AUDIO_VOICES; ++i) {
+			if (voices[i].samples == NULL) {
+				voice = &voices[i];
+				break;
+			} else if (voices[i].started < voice->started) {
+				voice = &voices[i];
+			}
+		}
+		voice->samples = &sample_pool[sound_samples[sound].offset];
+		voice->length = sound_samples[sound].length;
+		voice->position = 0;
+		voice->started = ++voices_started;
+	}
+	sound_queue.head.store(head, memory_order_release);
+
+	memset(mix_buffer, 0, frames * sizeof(int32));
+	for (int i = 0; i < AUDIO_VOICES; ++i) {
+		AudioVoice *voice = &voices[i];
+		if (voice->samples == NULL)
+			continue;
+		int count = SDL_min(frames, voice->length - voice->position);
+		const int16 *samples = voice->samples + voice->position;
+		for (int k = 0; k < count; ++k) {
+			mix_buffer[k] += samples[k];
+		}
+		voice->position += count;
+		if (voice->position == voice->length) {
+			voice->samples = NULL;
+		}
+	}
+	for (int k = 0; k < frames; ++k) {
+		out[k] = (int16)SDL_max(-32768, SDL_min(32767, mix_buffer[k]));
+	}
+	// in case SDL asked for more than the mix buffer holds
+	memset(out + frames, 0, size - frames * sizeof(int16));
+}
+
+int startAudio(GameData *gd, int buffer_frames) {
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		SDL_Log("Starting audio failed: %s", SDL_GetError());
+		return -1;
+	}
+
+	sample_pool.clear();
+	makeSound(SOUND_ROTOR_TURN, 0.04f, 900, 500, 0.5f, 0.25f);
+	makeSound(SOUND_BALL_INSERTED, 0.08f, 660, 880, 0.0f, 0.3f);
+	makeSound(SOUND_ROTOR_DESTROYED, 0.5f, 220, 55, 0.3f, 0.5f);
+	memset(voices, 0, sizeof(voices));
+	sound_queue.tail.store(0);
+	sound_queue.head.store(0);
+
+	SDL_AudioSpec wanted;
+	SDL_zero(wanted);
+	wanted.freq = AUDIO_FREQUENCY;
+	wanted.format = AUDIO_S16SYS;
+	wanted.channels = 1;
+	// small buffers keep the time from click to sound short
+	wanted.samples = (Uint16)buffer_frames;
+	wanted.callback = mixAudio;
+	SDL_AudioSpec obtained;
+	audio_device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, 0);
+	if (audio_device == 0) {
+		SDL_Log("Opening audio device failed: %s", SDL_GetError());
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return -1;
+	}
+	SDL_Log("Audio: %d Hz, %d frames per buffer (%.1f ms)", obtained.freq, obtained.samples, obtained.samples * 1000.0 / obtained.freq);
+
+	subscribeEvents(gd, &audio_events);
+	SDL_PauseAudioDevice(audio_device, 0);
+	return 0;
+}
+
+void stopAudio(GameData *gd) {
+	if (audio_device == 0)
+		return;
+	SDL_CloseAudioDevice(audio_device);
+	audio_device = 0;
+	unsubscribeEvents(gd, &audio_events);
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+void playSound(int sound) {
+	if (audio_device == 0)
+		return;
+	uint32 tail = sound_queue.tail.load(memory_order_relaxed);
+	if (tail - sound_queue.head.load(memory_order_acquire) == AUDIO_QUEUE_SIZE)
+		return;
+	sound_queue.sounds[tail % AUDIO_QUEUE_SIZE] = sound;
+	sound_queue.tail.store(tail + 1, memory_order_release);
+}
+
+void playEventSounds(GameData *gd) {
+	if (audio_device == 0)
+		return;
+	// the same sound many times in one tick is not any louder
+	bool played[SOUND_COUNT] = {};
+	GameEvent events[64];
+	int count;
+	while ((count = readEvents(gd, &audio_events, events, 64)) > 0) {
+		for (int i = 0; i < count; ++i) {
+			int sound = -1;
+			if (events[i].type == EVENT_ROTOR_TURNED) {
+				sound = SOUND_ROTOR_TURN;
+			} else if (events[i].type == EVENT_BALL_IN_ROTOR) {
+				sound = SOUND_BALL_INSERTED;
+			} else if (events[i].type == EVENT_ROTOR_DESTROYED) {
+				sound = SOUND_ROTOR_DESTROYED;
+			}
+			if (sound >= 0 && !played[sound]) {
+				playSound(sound);
+				played[sound] = true;
+			}
+		}
+	}
+}
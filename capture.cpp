@@ -0,0 +1,369 @@
+#include "logical.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Frame capture renders every frame into one of two offscreen textures and
+// reads it back one frame later. SDL2 has no non-blocking readback,
+// SDL_RenderReadPixels flushes the renderer and waits for the GPU, so the
+// previous frame is read back before the next one is drawn: it has had a whole
+// frame's time to finish, and the flush has nothing new to wait for. Read back
+// frames go to an encoder thread that does all the disk and format work.
+//
+// In real time, frames are dropped when the encoder falls behind instead of
+// stalling the game. Offline captures wait for the encoder instead, so they
+// keep every frame and simply run as fast as encoding allows.
+
+#define CAPTURE_BUFFERS 8
+
+struct CaptureFrame {
+	vector<byte> pixels;
+	int64 number;
+};
+
+struct Capture {
+	bool active;
+	string path;
+	int format;
+	int fps;
+	bool offline;
+	int width;
+	int height;
+
+	SDL_Texture *targets[2];
+	int64 frames_rendered;
+	int64 frames_dropped;
+
+	// frames travel from free to queued and back
+	mutex queue_mutex;
+	condition_variable queue_condition;
+	vector<CaptureFrame *> free_frames;
+	deque<CaptureFrame *> queued_frames;
+	bool stopping;
+	thread encoder;
+
+	FILE *file;
+	vector<byte> scratch;
+};
+
+static Capture capture;
+
+// encoders
+
+static uint32 crc_table[256];
+
+static void initCrcTable() {
+	for (uint32 n = 0; n < 256; ++n) {
+		uint32 c = n;
+		for (int k = 0; k < 8; ++k) {
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
+	}
+}
+
+static uint32 updateCrc(uint32 crc, const byte *data, size_t size) {
+	for (size_t i = 0; i < size; ++i) {
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static void putBigEndian(vector<byte> *out, uint32 value) {
+	out->push_back(value >> 24);
+	out->push_back(value >> 16);
+	out->push_back(value >> 8);
+	out->push_back(value);
+}
+
+static void writePngChunk(FILE *file, const char *type, const vector<byte> &data) {
+	vector<byte> header;
+	putBigEndian(&header, (uint32)data.size());
+	header.insert(header.end(), type, type + 4);
+	uint32 crc = updateCrc(0xFFFFFFFF, (const byte *)type, 4);
+	crc = updateCrc(crc, data.data(), data.size()) ^ 0xFFFFFFFF;
+	vector<byte> footer;
+	putBigEndian(&footer, crc);
+	fwrite(header.data(), 1, header.size(), file);
+	fwrite(data.data(), 1, data.size(), file);
+	fwrite(footer.data(), 1, footer.size(), file);
+}
+
+// PNG with stored deflate blocks: no compression, but also no zlib needed
+static void writePng(const CaptureFrame *frame) {
+	char name[1024];
+	SDL_snprintf(name, sizeof(name), "%s_%06d.png", capture.path.c_str(), (int)frame->number);
+	FILE *file = fopen(name, "wb");
+	if (file == NULL) {
+		SDL_Log("Writing %s failed", name);
+		return;
+	}
+
+	static const byte signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, sizeof(signature), file);
+
+	vector<byte> ihdr;
+	putBigEndian(&ihdr, capture.width);
+	putBigEndian(&ihdr, capture.height);
+	ihdr.push_back(8); // bit depth
+	ihdr.push_back(6); // RGBA
+	ihdr.push_back(0); // deflate
+	ihdr.push_back(0); // no filters
+	ihdr.push_back(0); // not interlaced
+	writePngChunk(file, "IHDR", ihdr);
+
+	// scanlines, each prefixed with filter type 0
+	int row_size = capture.width * 4;
+	vector<byte> *raw = &capture.scratch;
+	raw->clear();
+	for (int y = 0; y < capture.height; ++y) {
+		raw->push_back(0);
+		const byte *row = &frame->pixels[y * row_size];
+		raw->insert(raw->end(), row, row + row_size);
+	}
+
+	vector<byte> idat;
+	idat.push_back(0x78);
+	idat.push_back(0x01);
+	uint32 adler_a = 1, adler_b = 0;
+	size_t offset = 0;
+	do {
+		size_t block = raw->size() - offset < 0xFFFF ? raw->size() - offset : 0xFFFF;
+		bool last = offset + block == raw->size();
+		idat.push_back(last ? 1 : 0);
+		idat.push_back(block & 0xFF);
+		idat.push_back(block >> 8);
+		idat.push_back(~block & 0xFF);
+		idat.push_back((~block >> 8) & 0xFF);
+		idat.insert(idat.end(), raw->begin() + offset, raw->begin() + offset + block);
+		for (size_t i = offset; i < offset + block; ++i) {
+			adler_a = (adler_a + (*raw)[i]) % 65521;
+			adler_b = (adler_b + adler_a) % 65521;
+		}
+		offset += block;
+	} while (offset < raw->size());
+	putBigEndian(&idat, (adler_b << 16) | adler_a);
+	writePngChunk(file, "IDAT", idat);
+	writePngChunk(file, "IEND", vector<byte>());
+
+	fclose(file);
+}
+
+static byte clampByte(int value) {
+	return value < 0 ? 0 : value > 255 ? 255 : (byte)value;
+}
+
+// YUV 4:2:0 with full range BT.601 coefficients
+static void writeY4mFrame(const CaptureFrame *frame) {
+	int w = capture.width;
+	int h = capture.height;
+	int cw = (w + 1) / 2;
+	int ch = (h + 1) / 2;
+	vector<byte> *yuv = &capture.scratch;
+	yuv->resize(w * h + 2 * cw * ch);
+	byte *plane_y = yuv->data();
+	byte *plane_u = plane_y + w * h;
+	byte *plane_v = plane_u + cw * ch;
+
+	const byte *pixels = frame->pixels.data();
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			const byte *p = &pixels[(y * w + x) * 4];
+			plane_y[y * w + x] = (byte)((77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8);
+		}
+	}
+	for (int y = 0; y < ch; ++y) {
+		for (int x = 0; x < cw; ++x) {
+			int r = 0, g = 0, b = 0;
+			for (int dy = 0; dy < 2; ++dy) {
+				for (int dx = 0; dx < 2; ++dx) {
+					int sx = x * 2 + dx < w ? x * 2 + dx : w - 1;
+					int sy = y * 2 + dy < h ? y * 2 + dy : h - 1;
+					const byte *p = &pixels[(sy * w + sx) * 4];
+					r += p[0];
+					g += p[1];
+					b += p[2];
+				}
+			}
+			r /= 4;
+			g /= 4;
+			b /= 4;
+			plane_u[y * cw + x] = clampByte(((-43 * r - 85 * g + 128 * b) >> 8) + 128);
+			plane_v[y * cw + x] = clampByte(((128 * r - 107 * g - 21 * b) >> 8) + 128);
+		}
+	}
+
+	fputs("FRAME\n", capture.file);
+	fwrite(yuv->data(), 1, yuv->size(), capture.file);
+}
+
+static void encodeFrame(const CaptureFrame *frame) {
+	if (capture.format == CAPTURE_PNG) {
+		writePng(frame);
+	} else if (capture.format == CAPTURE_Y4M) {
+		writeY4mFrame(frame);
+	} else {
+		fwrite(frame->pixels.data(), 1, frame->pixels.size(), capture.file);
+	}
+}
+
+static void encoderMain() {
+	while (true) {
+		CaptureFrame *frame;
+		{
+			unique_lock<mutex> lock(capture.queue_mutex);
+			capture.queue_condition.wait(lock, [] { return capture.stopping || !capture.queued_frames.empty(); });
+			if (capture.queued_frames.empty())
+				return;
+			frame = capture.queued_frames.front();
+			capture.queued_frames.pop_front();
+		}
+
+		encodeFrame(frame);
+
+		{
+			lock_guard<mutex> lock(capture.queue_mutex);
+			capture.free_frames.push_back(frame);
+		}
+		capture.queue_condition.notify_all();
+	}
+}
+
+// readback
+
+static void readBackFrame(GameData *gd, SDL_Texture *target, int64 number) {
+	CaptureFrame *frame = NULL;
+	{
+		unique_lock<mutex> lock(capture.queue_mutex);
+		if (capture.offline) {
+			capture.queue_condition.wait(lock, [] { return !capture.free_frames.empty(); });
+		}
+		if (!capture.free_frames.empty()) {
+			frame = capture.free_frames.back();
+			capture.free_frames.pop_back();
+		}
+	}
+	if (frame == NULL) {
+		++capture.frames_dropped;
+		return;
+	}
+
+	SDL_SetRenderTarget(gd->renderer, target);
+	if (SDL_RenderReadPixels(gd->renderer, NULL, SDL_PIXELFORMAT_RGBA32, frame->pixels.data(), capture.width * 4) != 0) {
+		SDL_Log("SDL_RenderReadPixels failed: %s", SDL_GetError());
+	}
+	frame->number = number;
+
+	{
+		lock_guard<mutex> lock(capture.queue_mutex);
+		capture.queued_frames.push_back(frame);
+	}
+	capture.queue_condition.notify_all();
+}
+
+int startCapture(GameData *gd, const char *path, int format, int fps, bool offline) {
+	SDL_GetWindowSize(gd->win, &capture.width, &capture.height);
+	for (int i = 0; i < 2; ++i) {
+		capture.targets[i] = SDL_CreateTexture(gd->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, capture.width, capture.height);
+		if (capture.targets[i] == NULL) {
+			SDL_Log("SDL_CreateTexture failed: %s", SDL_GetError());
+			return -1;
+		}
+	}
+
+	capture.path = path;
+	capture.format = format;
+	capture.fps = fps;
+	capture.offline = offline;
+	capture.file = NULL;
+	if (format == CAPTURE_RAW || format == CAPTURE_Y4M) {
+		capture.file = fopen(path, "wb");
+		if (capture.file == NULL) {
+			SDL_Log("Opening %s for capture failed", path);
+			return -1;
+		}
+	}
+	if (format == CAPTURE_Y4M) {
+		fprintf(capture.file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", capture.width, capture.height, fps);
+	}
+	initCrcTable();
+
+	for (int i = 0; i < CAPTURE_BUFFERS; ++i) {
+		CaptureFrame *frame = new CaptureFrame;
+		frame->pixels.resize(capture.width * capture.height * 4);
+		capture.free_frames.push_back(frame);
+	}
+	capture.frames_rendered = 0;
+	capture.frames_dropped = 0;
+	capture.stopping = false;
+	capture.encoder = thread(encoderMain);
+	capture.active = true;
+	SDL_Log("Capturing %dx%d frames to %s", capture.width, capture.height, path);
+	return 0;
+}
+
+void captureFrame(GameData *gd) {
+	if (!capture.active) {
+		renderEverything(gd);
+		return;
+	}
+
+	int64 number = capture.frames_rendered++;
+	// before anything of this frame is queued, it would be flushed and waited for as well
+	if (number > 0) {
+		readBackFrame(gd, capture.targets[(number - 1) % 2], number - 1);
+	}
+
+	SDL_Texture *current = capture.targets[number % 2];
+	SDL_SetRenderTarget(gd->renderer, current);
+	renderScene(gd);
+
+	SDL_SetRenderTarget(gd->renderer, NULL);
+	if (!capture.offline) {
+		SDL_RenderCopy(gd->renderer, current, NULL, NULL);
+		SDL_RenderPresent(gd->renderer);
+	}
+}
+
+void stopCapture(GameData *gd) {
+	if (!capture.active)
+		return;
+
+	// the last frame has not been read back yet
+	if (capture.frames_rendered > 0) {
+		bool offline = capture.offline;
+		capture.offline = true;
+		int64 last = capture.frames_rendered - 1;
+		readBackFrame(gd, capture.targets[last % 2], last);
+		capture.offline = offline;
+		SDL_SetRenderTarget(gd->renderer, NULL);
+	}
+
+	{
+		lock_guard<mutex> lock(capture.queue_mutex);
+		capture.stopping = true;
+	}
+	capture.queue_condition.notify_all();
+	capture.encoder.join();
+
+	for (size_t i = 0; i < capture.free_frames.size(); ++i) {
+		delete capture.free_frames[i];
+	}
+	capture.free_frames.clear();
+	for (int i = 0; i < 2; ++i) {
+		SDL_DestroyTexture(capture.targets[i]);
+	}
+	if (capture.file != NULL) {
+		fclose(capture.file);
+	}
+	capture.active = false;
+	SDL_Log("Captured %d frames, dropped %d", (int)(capture.frames_rendered - capture.frames_dropped), (int)capture.frames_dropped);
+}
@@ -0,0 +1,171 @@
+#include "server.hpp"
+
+#include <cstring>
+
+using namespace std;
+
+// Stand-in client for the game server. It mirrors one session into a local
+// GameData, which is enough to render it or to let a bot look at it.
+
+static void sendMessage(Client *client, int type, const void *payload, int payload_size) {
+	NetMessageHeader header;
+	header.size = sizeof(header) + payload_size;
+	header.type = type;
+	header.reserved = 0;
+	header.session = client->session;
+	const byte *bytes = (const byte *)&header;
+	client->output.insert(client->output.end(), bytes, bytes + sizeof(header));
+	bytes = (const byte *)payload;
+	client->output.insert(client->output.end(), bytes, bytes + payload_size);
+}
+
+int connectClient(Client *client, const char *address, GameData *gd) {
+	client->socket = connectTo(address);
+	client->session = 0;
+	client->tick = 0;
+	client->synchronized = false;
+	client->gd = gd;
+	client->input.clear();
+	client->output.clear();
+	client->snapshot.clear();
+	return client->socket != SOCKET_NONE ? 0 : -1;
+}
+
+void disconnectClient(Client *client) {
+	closeSocket(client->socket);
+	client->socket = SOCKET_NONE;
+	client->synchronized = false;
+}
+
+void clientOpenSession(Client *client, int map_number, uint32 seed) {
+	NetOpenSession open;
+	open.map_number = map_number;
+	open.seed = seed;
+	sendMessage(client, MSG_OPEN_SESSION, &open, sizeof(open));
+}
+
+void clientSubscribe(Client *client, uint32 session) {
+	client->session = session;
+	client->synchronized = false;
+	sendMessage(client, MSG_SUBSCRIBE, NULL, 0);
+}
+
+void clientTurnRotor(Client *client, int rotor_index, int direction) {
+	NetRotorCommand command;
+	command.rotor_index = rotor_index;
+	command.argument = direction;
+	sendMessage(client, MSG_TURN_ROTOR, &command, sizeof(command));
+}
+
+void clientReleaseBall(Client *client, int rotor_index, int position) {
+	NetRotorCommand command;
+	command.rotor_index = rotor_index;
+	command.argument = position;
+	sendMessage(client, MSG_RELEASE_BALL, &command, sizeof(command));
+}
+
+void clientReset(Client *client) {
+	sendMessage(client, MSG_RESET, NULL, 0);
+}
+
+void clientSendAction(Client *client, const Action *action) {
+	if (action->type == ACTION_TURN_ROTOR) {
+		clientTurnRotor(client, action->target, action->argument);
+	} else if (action->type == ACTION_RELEASE_BALL) {
+		clientReleaseBall(client, action->target, action->argument);
+	} else if (action->type == ACTION_RESET) {
+		clientReset(client);
+	}
+}
+
+static void handleKeyframe(Client *client, const byte *payload, int payload_size) {
+	NetKeyframe frame;
+	if (payload_size < (int)sizeof(frame))
+		return;
+	memcpy(&frame, payload, sizeof(frame));
+	// servers only ever open sessions on built-in maps
+	if (frame.map_number < 1 || frame.map_number > MAP_COUNT) {
+		SDL_Log("Received keyframe for unknown map %d", frame.map_number);
+		client->synchronized = false;
+		return;
+	}
+	GameData *gd = client->gd;
+	if (!client->synchronized || gd->map_number != frame.map_number || gd->seed != frame.seed) {
+		newGame(gd, frame.map_number, frame.seed);
+	}
+	client->snapshot.assign(payload + sizeof(frame), payload + payload_size);
+	client->synchronized = unpackGame(gd, client->snapshot.data(), (int)client->snapshot.size()) == 0;
+	client->tick = frame.tick;
+}
+
+static void handleDelta(Client *client, const byte *payload, int payload_size) {
+	NetDelta delta;
+	if (!client->synchronized || payload_size < (int)sizeof(delta))
+		return;
+	memcpy(&delta, payload, sizeof(delta));
+	if (applySnapshotDelta(client->snapshot, payload + sizeof(delta), payload_size - sizeof(delta), &client->scratch) != 0) {
+		SDL_Log("Received broken delta for tick %u", delta.tick);
+		client->synchronized = false;
+		return;
+	}
+	client->snapshot.swap(client->scratch);
+	client->synchronized = unpackGame(client->gd, client->snapshot.data(), (int)client->snapshot.size()) == 0;
+	client->tick = delta.tick;
+}
+
+int pollClient(Client *client) {
+	if (client->socket == SOCKET_NONE)
+		return -1;
+
+	// send pending commands
+	size_t sent_total = 0;
+	while (sent_total < client->output.size()) {
+		int sent = sendSome(client->socket, client->output.data() + sent_total, (int)(client->output.size() - sent_total));
+		if (sent < 0)
+			return -1;
+		if (sent == 0)
+			break;
+		sent_total += sent;
+	}
+	client->output.erase(client->output.begin(), client->output.begin() + sent_total);
+
+	// receive updates
+	byte buffer[16384];
+	while (true) {
+		int received = receiveSome(client->socket, buffer, sizeof(buffer));
+		if (received < 0)
+			return -1;
+		if (received == 0)
+			break;
+		client->input.insert(client->input.end(), buffer, buffer + received);
+	}
+
+	int updates = 0;
+	size_t offset = 0;
+	while (client->input.size() - offset >= sizeof(NetMessageHeader)) {
+		NetMessageHeader header;
+		memcpy(&header, &client->input[offset], sizeof(header));
+		if (header.size < sizeof(header) || header.size > NET_MESSAGE_MAX_SIZE)
+			return -1;
+		if (client->input.size() - offset < header.size)
+			break;
+		const byte *payload = &client->input[offset + sizeof(header)];
+		int payload_size = header.size - sizeof(header);
+
+		if (header.type == MSG_SESSION_OPENED) {
+			SDL_Log("Opened session %u", header.session);
+			clientSubscribe(client, header.session);
+		} else if (header.type == MSG_KEYFRAME && header.session == client->session) {
+			handleKeyframe(client, payload, payload_size);
+			++updates;
+		} else if (header.type == MSG_DELTA && header.session == client->session) {
+			handleDelta(client, payload, payload_size);
+			++updates;
+		} else if (header.type == MSG_ERROR) {
+			SDL_Log("Server refused request for session %u", header.session);
+		}
+		offset += header.size;
+	}
+	client->input.erase(client->input.begin(), client->input.begin() + offset);
+	return updates;
+}
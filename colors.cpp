@@ -0,0 +1,13 @@
+#include "logical.hpp"
+
+// by ball type + 1, shared by the renderer and the software rasteriser
+const Uint8 BALL_COLORS[][4] = {
+	{   0,   0,   0, SDL_ALPHA_OPAQUE },
+	{ 255,   0,   0, SDL_ALPHA_OPAQUE },
+	{   0, 255,   0, SDL_ALPHA_OPAQUE },
+	{   0,   0, 255, SDL_ALPHA_OPAQUE },
+	{   0, 255, 255, SDL_ALPHA_OPAQUE },
+	{ 255,   0, 255, SDL_ALPHA_OPAQUE },
+	{ 255, 255,   0, SDL_ALPHA_OPAQUE },
+	{ 255, 255, 255, SDL_ALPHA_OPAQUE },
+};
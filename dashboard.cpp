@@ -0,0 +1,355 @@
+#include "logical.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Dashboard: many games side by side in one window, for watching a batch of
+// simulations.
+//
+// The boards tick together on the worker threads, a random player on each
+// one keeps something happening. Drawing does not go through the camera of
+// the single game view. What never changes on a map (lines and rotors) is
+// drawn once into a texture per distinct map, then every board is one
+// textured quad of it, submitted in one call per map. Everything else
+// (destroyed rotors, balls, rotor centers) of all boards goes into one
+// vertex buffer and one SDL_RenderGeometry call, so the number of draw calls
+// does not grow with the number of boards. Needs SDL 2.0.18.
+
+// pixels between the boards
+#define DASHBOARD_GAP 4
+// about one action per second on every board
+#define DASHBOARD_BOT_CHANCE 60
+
+struct DashboardBoard {
+	GameData *gd;
+	// to notice resets, which build the map anew
+	uint32 map_id;
+	// boards with the same key have the same map, see hashMap
+	uint64 map_key;
+	float min_x;
+	float min_y;
+	float max_x;
+	float max_y;
+	// where the board is in the window this frame
+	float x;
+	float y;
+	float scale;
+	Random bot;
+};
+
+// the lines and live rotors of a map, drawn once at the size the boards have
+struct MapTexture {
+	uint64 key;
+	SDL_Texture *texture;
+	int width;
+	int height;
+	vector<SDL_Vertex> vertices;
+	vector<int> indices;
+};
+
+static vector<DashboardBoard> boards;
+static vector<MapTexture> map_textures;
+static vector<SDL_Vertex> vertices;
+static vector<int> indices;
+
+static const SDL_Color ROTOR_COLOR = { 0xCC, 0xCC, 0xCC, SDL_ALPHA_OPAQUE };
+static const SDL_Color ROTOR_DESTROYED_COLOR = { 0x66, 0x66, 0x66, SDL_ALPHA_OPAQUE };
+static const SDL_Color OUTLINE_COLOR = { 0xFF, 0xFF, 0xFF, SDL_ALPHA_OPAQUE };
+
+static void hashValue(uint64 *hash, const void *value, int size) {
+	const byte *bytes = (const byte *)value;
+	for (int i = 0; i < size; ++i) {
+		*hash ^= bytes[i];
+		*hash *= 1099511628211ULL;
+	}
+}
+
+// what the texture shows: where the lines and rotors are, not what connects to what
+static void hashMap(DashboardBoard *board) {
+	const GameData *gd = board->gd;
+	uint64 hash = 14695981039346656037ULL;
+	float min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+	for (int i = 0; i < gd->line_count; ++i) {
+		const Line *line = &gd->lines[i];
+		hashValue(&hash, &line->x1, sizeof(float));
+		hashValue(&hash, &line->y1, sizeof(float));
+		hashValue(&hash, &line->x2, sizeof(float));
+		hashValue(&hash, &line->y2, sizeof(float));
+		if (i == 0) {
+			min_x = max_x = line->x1;
+			min_y = max_y = line->y1;
+		}
+		min_x = SDL_min(min_x, SDL_min(line->x1, line->x2));
+		min_y = SDL_min(min_y, SDL_min(line->y1, line->y2));
+		max_x = SDL_max(max_x, SDL_max(line->x1, line->x2));
+		max_y = SDL_max(max_y, SDL_max(line->y1, line->y2));
+	}
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		const Rotor *rotor = &gd->rotors[i];
+		hashValue(&hash, &rotor->x, sizeof(float));
+		hashValue(&hash, &rotor->y, sizeof(float));
+		if (i == 0 && gd->line_count == 0) {
+			min_x = max_x = rotor->x;
+			min_y = max_y = rotor->y;
+		}
+		min_x = SDL_min(min_x, rotor->x - 30);
+		min_y = SDL_min(min_y, rotor->y - 30);
+		max_x = SDL_max(max_x, rotor->x + 30);
+		max_y = SDL_max(max_y, rotor->y + 30);
+	}
+	hashValue(&hash, &gd->line_count, sizeof(int));
+	hashValue(&hash, &gd->rotor_count, sizeof(int));
+	board->map_key = hash;
+	board->map_id = gd->map_id;
+	board->min_x = min_x;
+	board->min_y = min_y;
+	// never empty, so the scale stays finite
+	board->max_x = SDL_max(max_x, min_x + 1);
+	board->max_y = SDL_max(max_y, min_y + 1);
+}
+
+// the first board is the screen game, it is built already
+static void buildBoard(void *context, int task_index) {
+	GameData *screen = (GameData *)context;
+	int board_index = task_index + 1;
+	GameData *gd = boards[board_index].gd;
+	gd->fixed_point = screen->fixed_point;
+	gd->line_spacing = screen->line_spacing;
+	gd->map_params = screen->map_params;
+	SDL_strlcpy(gd->map_path, screen->map_path, sizeof(gd->map_path));
+	newGame(gd, screen->map_number, screen->seed + board_index);
+}
+
+// the screen game is the first board, the others get the same map and the following seeds
+int startDashboard(GameData *screen, int board_count) {
+	boards.resize(board_count);
+	for (int i = 0; i < board_count; ++i) {
+		boards[i].gd = i == 0 ? screen : new GameData();
+		boards[i].map_id = 0;
+		random_seed(&boards[i].bot, screen->seed + i);
+	}
+	// building maps is the slow part of starting, and quiet
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+	runOnWorkers(board_count - 1, buildBoard, screen);
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
+	SDL_Log("Dashboard with %d boards", board_count);
+	return 0;
+}
+
+void stopDashboard() {
+	for (size_t i = 1; i < boards.size(); ++i) {
+		delete boards[i].gd;
+	}
+	boards.clear();
+	for (size_t i = 0; i < map_textures.size(); ++i) {
+		SDL_DestroyTexture(map_textures[i].texture);
+	}
+	map_textures.clear();
+}
+
+static void tickBoard(void *context, int board_index) {
+	Time t = *(const Time *)context;
+	DashboardBoard *board = &boards[board_index];
+	GameData *gd = board->gd;
+	if (gd->rotor_count > 0 && random_get(&board->bot) % DASHBOARD_BOT_CHANCE == 0) {
+		Action action;
+		action.target = random_get(&board->bot) % gd->rotor_count;
+		if (random_get(&board->bot) % 2 == 0) {
+			action.type = ACTION_TURN_ROTOR;
+			action.argument = random_get(&board->bot) % 2 == 0 ? ROTOR_CLOCKWISE : ROTOR_ANTICLOCKWISE;
+		} else {
+			action.type = ACTION_RELEASE_BALL;
+			action.argument = random_get(&board->bot) % 4;
+		}
+		applyAction(gd, &action);
+	}
+	rememberBallPositions(gd);
+	progressLogic(gd, t);
+}
+
+// one tick of every board, each board on one worker
+void tickDashboard(Time t) {
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+	runOnWorkers((int)boards.size(), tickBoard, &t);
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
+}
+
+static void addQuad(vector<SDL_Vertex> *quad_vertices, vector<int> *quad_indices, float x1, float y1, float x2, float y2, SDL_Color color, float u1, float v1, float u2, float v2) {
+	int first = (int)quad_vertices->size();
+	SDL_Vertex vertex;
+	vertex.color = color;
+	vertex.position.x = x1, vertex.position.y = y1, vertex.tex_coord.x = u1, vertex.tex_coord.y = v1;
+	quad_vertices->push_back(vertex);
+	vertex.position.x = x2, vertex.position.y = y1, vertex.tex_coord.x = u2, vertex.tex_coord.y = v1;
+	quad_vertices->push_back(vertex);
+	vertex.position.x = x2, vertex.position.y = y2, vertex.tex_coord.x = u2, vertex.tex_coord.y = v2;
+	quad_vertices->push_back(vertex);
+	vertex.position.x = x1, vertex.position.y = y2, vertex.tex_coord.x = u1, vertex.tex_coord.y = v2;
+	quad_vertices->push_back(vertex);
+	static const int QUAD_INDICES[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; ++i) {
+		quad_indices->push_back(first + QUAD_INDICES[i]);
+	}
+}
+
+// a square of the given half size around a world point of the board
+static void addSquare(const DashboardBoard *board, float x, float y, float half_size, SDL_Color color) {
+	float screen_x = board->x + (x - board->min_x) * board->scale;
+	float screen_y = board->y + (y - board->min_y) * board->scale;
+	float half = SDL_max(half_size * board->scale, 0.5f);
+	addQuad(&vertices, &indices, screen_x - half, screen_y - half, screen_x + half, screen_y + half, color, 0, 0, 0, 0);
+}
+
+static void drawMapTexture(GameData *screen, const DashboardBoard *board, MapTexture *map) {
+	SDL_Renderer *renderer = screen->renderer;
+	const GameData *gd = board->gd;
+	SDL_SetRenderTarget(renderer, map->texture);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+	SDL_RenderClear(renderer);
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
+	for (int i = 0; i < gd->line_count; ++i) {
+		const Line *line = &gd->lines[i];
+		SDL_RenderDrawLine(renderer,
+			(int)((line->x1 - board->min_x) * board->scale), (int)((line->y1 - board->min_y) * board->scale),
+			(int)((line->x2 - board->min_x) * board->scale), (int)((line->y2 - board->min_y) * board->scale));
+	}
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		const Rotor *rotor = &gd->rotors[i];
+		int size = SDL_max((int)(60 * board->scale), 1);
+		SDL_Rect rect = {(int)((rotor->x - 30 - board->min_x) * board->scale), (int)((rotor->y - 30 - board->min_y) * board->scale), size, size};
+		SDL_SetRenderDrawColor(renderer, ROTOR_COLOR.r, ROTOR_COLOR.g, ROTOR_COLOR.b, ROTOR_COLOR.a);
+		SDL_RenderFillRect(renderer, &rect);
+		SDL_SetRenderDrawColor(renderer, OUTLINE_COLOR.r, OUTLINE_COLOR.g, OUTLINE_COLOR.b, OUTLINE_COLOR.a);
+		SDL_RenderDrawRect(renderer, &rect);
+	}
+	SDL_SetRenderTarget(renderer, NULL);
+}
+
+// the texture for the map of the board, made or redrawn when the boards changed size
+static MapTexture *getMapTexture(GameData *screen, const DashboardBoard *board) {
+	int width = (int)ceilf((board->max_x - board->min_x) * board->scale) + 1;
+	int height = (int)ceilf((board->max_y - board->min_y) * board->scale) + 1;
+	MapTexture *map = NULL;
+	for (size_t i = 0; i < map_textures.size(); ++i) {
+		if (map_textures[i].key == board->map_key) {
+			map = &map_textures[i];
+		}
+	}
+	if (map == NULL) {
+		map_textures.push_back(MapTexture());
+		map = &map_textures.back();
+		map->key = board->map_key;
+		map->texture = NULL;
+	}
+	if (map->texture == NULL || map->width != width || map->height != height) {
+		SDL_DestroyTexture(map->texture);
+		map->texture = SDL_CreateTexture(screen->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, width, height);
+		if (map->texture == NULL) {
+			SDL_Log("SDL_CreateTexture failed: %s", SDL_GetError());
+			return NULL;
+		}
+		map->width = width;
+		map->height = height;
+		drawMapTexture(screen, board, map);
+	}
+	return map;
+}
+
+void renderDashboard(GameData *screen) {
+	int board_count = (int)boards.size();
+	int width, height;
+	SDL_GetWindowSize(screen->win, &width, &height);
+	// as square as the window allows
+	int columns = SDL_max((int)ceilf(sqrtf(board_count * (float)width / SDL_max(height, 1))), 1);
+	columns = SDL_min(columns, board_count);
+	int rows = (board_count + columns - 1) / columns;
+	float tile_width = (float)width / columns;
+	float tile_height = (float)height / rows;
+
+	vertices.clear();
+	indices.clear();
+	for (size_t i = 0; i < map_textures.size(); ++i) {
+		map_textures[i].vertices.clear();
+		map_textures[i].indices.clear();
+	}
+
+	for (int i = 0; i < board_count; ++i) {
+		DashboardBoard *board = &boards[i];
+		const GameData *gd = board->gd;
+		if (board->map_id != gd->map_id) {
+			hashMap(board);
+		}
+		// fit the map into its tile, centered
+		float map_width = board->max_x - board->min_x;
+		float map_height = board->max_y - board->min_y;
+		board->scale = SDL_min((tile_width - DASHBOARD_GAP) / map_width, (tile_height - DASHBOARD_GAP) / map_height);
+		board->scale = SDL_max(board->scale, 0.001f);
+		board->x = floorf((i % columns) * tile_width + (tile_width - map_width * board->scale) / 2);
+		board->y = floorf((i / columns) * tile_height + (tile_height - map_height * board->scale) / 2);
+
+		MapTexture *map = getMapTexture(screen, board);
+		if (map != NULL) {
+			SDL_Color white = { 255, 255, 255, SDL_ALPHA_OPAQUE };
+			addQuad(&map->vertices, &map->indices, board->x, board->y, board->x + map->width, board->y + map->height, white, 0, 0, 1, 1);
+		}
+
+		// destroyed rotors over the live ones of the texture, inside their outline
+		for (int k = 0; k < gd->rotor_count; ++k) {
+			if (gd->rotors[k].destroyed) {
+				addSquare(board, gd->rotors[k].x, gd->rotors[k].y, 30 - 1 / board->scale, ROTOR_DESTROYED_COLOR);
+			}
+		}
+		for (int k = 0; k < gd->ball_end; ++k) {
+			const Ball *ball = &gd->balls[k];
+			if (ball->type == BALL_TYPE_NONE)
+				continue;
+			float x, y;
+			getBallPosition(gd, k, &x, &y);
+			if (ball->has_prev && screen->interpolation < 1.0f) {
+				x = ball->prev_x + (x - ball->prev_x) * screen->interpolation;
+				y = ball->prev_y + (y - ball->prev_y) * screen->interpolation;
+			}
+			SDL_Color color = { BALL_COLORS[ball->type + 1][0], BALL_COLORS[ball->type + 1][1], BALL_COLORS[ball->type + 1][2], BALL_COLORS[ball->type + 1][3] };
+			addSquare(board, x, y, 10, color);
+		}
+		for (int k = 0; k < gd->rotor_count; ++k) {
+			addSquare(board, gd->rotors[k].x, gd->rotors[k].y, 10, OUTLINE_COLOR);
+			addSquare(board, gd->rotors[k].x, gd->rotors[k].y, 10 - 1 / board->scale, gd->rotors[k].destroyed ? ROTOR_DESTROYED_COLOR : ROTOR_COLOR);
+		}
+	}
+
+	SDL_SetRenderDrawColor(screen->renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+	SDL_RenderClear(screen->renderer);
+	for (size_t i = 0; i < map_textures.size(); ++i) {
+		MapTexture *map = &map_textures[i];
+		if (!map->indices.empty()) {
+			SDL_RenderGeometry(screen->renderer, map->texture, map->vertices.data(), (int)map->vertices.size(), map->indices.data(), (int)map->indices.size());
+		}
+	}
+	if (!indices.empty()) {
+		SDL_RenderGeometry(screen->renderer, NULL, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+	}
+	SDL_RenderPresent(screen->renderer);
+
+	// maps no board shows any more, after resets
+	size_t kept = 0;
+	for (size_t i = 0; i < map_textures.size(); ++i) {
+		if (map_textures[i].indices.empty()) {
+			SDL_DestroyTexture(map_textures[i].texture);
+		} else {
+			if (kept != i) {
+				swap(map_textures[kept], map_textures[i]);
+			}
+			++kept;
+		}
+	}
+	map_textures.resize(kept);
+
+	if (screen->dirty_rects) {
+		// the software renderer draws into the window surface
+		SDL_UpdateWindowSurface(screen->win);
+	}
+}
@@ -0,0 +1,188 @@
+#include "env.hpp"
+#include "logical.hpp"
+
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+static_assert(sizeof(LogicalAction) == sizeof(Action), "LogicalAction must match Action");
+static_assert(sizeof(LogicalObservationHeader) == 48, "LogicalObservationHeader must not contain padding");
+static_assert(sizeof(LogicalRotorObservation) == 16, "LogicalRotorObservation must not contain padding");
+static_assert(sizeof(LogicalBallObservation) == 20, "LogicalBallObservation must not contain padding");
+
+// same tick as the game loop
+static const Time ENV_TICK_TIME = seconds(1) / 60;
+
+// the thread pool lives as long as any handle does
+static int live_handles = 0;
+
+struct LogicalEnvs {
+	vector<GameData> games;
+	// where the actions of every game start, filled in by logical_step
+	vector<int32> action_offsets;
+};
+
+struct EnvJob {
+	LogicalEnvs *envs;
+	const Action *actions;
+	const int32 *action_counts;
+	const uint8 *mask;
+	int32 tick_count;
+	byte *buffer;
+};
+
+static size_t observationSize() {
+	size_t size = sizeof(LogicalObservationHeader) + NROTORS * sizeof(LogicalRotorObservation) +
+		NBALLS * sizeof(LogicalBallObservation) + NSPAWNS * sizeof(int32);
+	// every observation starts on its own cache line
+	return (size + 63) / 64 * 64;
+}
+
+LogicalEnvs *logical_create(int32_t env_count, int32_t map_number, const uint32_t *seeds, int32_t thread_count) {
+	if (env_count < 1)
+		return NULL;
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+	if (thread_count > getWorkerCount()) {
+		startWorkers(thread_count);
+	}
+	++live_handles;
+
+	LogicalEnvs *envs = new LogicalEnvs;
+	envs->games.resize(env_count);
+	envs->action_offsets.resize(env_count);
+	for (int i = 0; i < env_count; ++i) {
+		if (newGame(&envs->games[i], map_number, seeds != NULL ? seeds[i] : i + 1) != 0) {
+			logical_destroy(envs);
+			return NULL;
+		}
+	}
+	return envs;
+}
+
+void logical_destroy(LogicalEnvs *envs) {
+	delete envs;
+	if (--live_handles == 0) {
+		stopWorkers();
+	}
+}
+
+int32_t logical_env_count(const LogicalEnvs *envs) {
+	return (int32_t)envs->games.size();
+}
+
+static void resetEnv(void *context, int env_index) {
+	EnvJob *job = (EnvJob *)context;
+	if (job->mask == NULL || job->mask[env_index] != 0) {
+		resetGame(&job->envs->games[env_index]);
+	}
+}
+
+void logical_reset(LogicalEnvs *envs, const uint8_t *mask) {
+	EnvJob job;
+	job.envs = envs;
+	job.mask = mask;
+	runOnWorkers((int)envs->games.size(), resetEnv, &job);
+}
+
+static void stepEnv(void *context, int env_index) {
+	EnvJob *job = (EnvJob *)context;
+	GameData *gd = &job->envs->games[env_index];
+	if (job->action_counts != NULL) {
+		const Action *actions = job->actions + job->envs->action_offsets[env_index];
+		for (int i = 0; i < job->action_counts[env_index]; ++i) {
+			applyAction(gd, &actions[i]);
+		}
+	}
+	for (int tick = 0; tick < job->tick_count; ++tick) {
+		progressLogic(gd, ENV_TICK_TIME);
+	}
+}
+
+void logical_step(LogicalEnvs *envs, const LogicalAction *actions, const int32_t *action_counts, int32_t tick_count) {
+	if (action_counts != NULL) {
+		int32 offset = 0;
+		for (size_t i = 0; i < envs->games.size(); ++i) {
+			envs->action_offsets[i] = offset;
+			offset += action_counts[i];
+		}
+	}
+	EnvJob job;
+	job.envs = envs;
+	job.actions = (const Action *)actions;
+	job.action_counts = action_counts;
+	job.tick_count = tick_count;
+	runOnWorkers((int)envs->games.size(), stepEnv, &job);
+}
+
+int64_t logical_observation_size(void) {
+	return (int64_t)observationSize();
+}
+
+static void observeEnv(void *context, int env_index) {
+	EnvJob *job = (EnvJob *)context;
+	const GameData *gd = &job->envs->games[env_index];
+	byte *observation = job->buffer + env_index * observationSize();
+	LogicalObservationHeader *header = (LogicalObservationHeader *)observation;
+	LogicalRotorObservation *rotors = (LogicalRotorObservation *)(header + 1);
+	LogicalBallObservation *balls = (LogicalBallObservation *)(rotors + NROTORS);
+	int32 *spawn_queue = (int32 *)(balls + NBALLS);
+
+	uint8 matches[NROTORS];
+	countRotorMatches(gd, matches);
+	int rotors_destroyed = 0;
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		const Rotor *rotor = &gd->rotors[i];
+		rotors[i].x = rotor->x;
+		rotors[i].y = rotor->y;
+		for (int pos = 0; pos < 4; ++pos) {
+			rotors[i].ball_types[pos] = (int8)((rotor->slots >> (8 * pos)) & 0xFF) - 1;
+		}
+		rotors[i].destroyed = rotor->destroyed;
+		rotors[i].matching = matches[i];
+		memset(rotors[i].reserved, 0, sizeof(rotors[i].reserved));
+		rotors_destroyed += rotor->destroyed;
+	}
+	memset(&rotors[gd->rotor_count], 0, (NROTORS - gd->rotor_count) * sizeof(LogicalRotorObservation));
+
+	// the padding up to the next cache line as well, observations get hashed and compared
+	memset(spawn_queue, 0, observation + observationSize() - (byte *)spawn_queue);
+	int ball_count = 0;
+	for (int i = 0; i < NBALLS; ++i) {
+		const Ball *ball = &gd->balls[i];
+		if (ball->type == BALL_TYPE_NONE)
+			continue;
+		LogicalBallObservation *observed = &balls[ball_count++];
+		getBallPosition(gd, i, &observed->x, &observed->y);
+		observed->index = i;
+		observed->target = ball->connector.target;
+		observed->type = ball->type;
+		observed->connector_type = ball->connector.type;
+		observed->rotor_position = ball->connector.type == CONNECTOR_ROTOR ? ball->connector.rotor.position : -1;
+		observed->reserved = 0;
+		if (ball->connector.type == CONNECTOR_SPAWN) {
+			++spawn_queue[ball->connector.target];
+		}
+	}
+	memset(&balls[ball_count], 0, (NBALLS - ball_count) * sizeof(LogicalBallObservation));
+
+	header->time = gd->time;
+	header->max_rotors = NROTORS;
+	header->max_balls = NBALLS;
+	header->max_spawns = NSPAWNS;
+	header->rotor_count = gd->rotor_count;
+	header->ball_count = ball_count;
+	header->rotors_destroyed = rotors_destroyed;
+	memset(header->reserved, 0, sizeof(header->reserved));
+}
+
+void logical_observe(const LogicalEnvs *envs, void *buffer) {
+	EnvJob job;
+	job.envs = (LogicalEnvs *)envs;
+	job.buffer = (byte *)buffer;
+	runOnWorkers((int)envs->games.size(), observeEnv, &job);
+}
+
+void logical_render(const LogicalEnvs *envs, int32_t width, int32_t height, void *buffer) {
+	rasterizeGames(&envs->games[0], (int)envs->games.size(), (byte *)buffer, width, height);
+}
@@ -0,0 +1,106 @@
+#ifndef ENV_HPP_
+#define ENV_HPP_
+
+#include <stdint.h>
+
+// C interface of the logical_env shared library, for training agents against
+// the game. One LogicalEnvs handle holds many independent games that are
+// stepped, reset and observed together, spread over a pool of threads, so a
+// trainer pays the call overhead once per batch instead of once per game.
+//
+// The games run exactly the same logic as the real one: actions go through
+// applyAction and every tick is a progressLogic call of 1/60 s.
+
+#if defined(_WIN32)
+	#if defined(LOGICAL_ENV_EXPORTS)
+		#define LOGICAL_ENV_API __declspec(dllexport)
+	#else
+		#define LOGICAL_ENV_API __declspec(dllimport)
+	#endif
+#else
+	#define LOGICAL_ENV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LogicalEnvs LogicalEnvs;
+
+// same layout and meaning as Action in actions.hpp
+typedef struct LogicalAction {
+	int32_t type;
+	int32_t target;
+	int32_t argument;
+} LogicalAction;
+
+// Every game writes one observation of logical_observation_size() bytes:
+// the header, then max_rotors rotors, max_balls balls and max_spawns spawn
+// queue lengths. Entries past rotor_count and ball_count are zero.
+typedef struct LogicalObservationHeader {
+	int64_t time;
+	int32_t max_rotors;
+	int32_t max_balls;
+	int32_t max_spawns;
+	int32_t rotor_count;
+	int32_t ball_count;
+	int32_t rotors_destroyed;
+	int32_t reserved[4];
+} LogicalObservationHeader;
+
+typedef struct LogicalRotorObservation {
+	float x;
+	float y;
+	// ball type in each position, -1 if empty
+	int8_t ball_types[4];
+	uint8_t destroyed;
+	// most balls of one type, 3 is one ball short of destroying the rotor
+	uint8_t matching;
+	uint8_t reserved[2];
+} LogicalRotorObservation;
+
+typedef struct LogicalBallObservation {
+	float x;
+	float y;
+	int32_t index;
+	int32_t target;
+	int8_t type;
+	int8_t connector_type;
+	// -1 unless the ball sits in a rotor
+	int8_t rotor_position;
+	int8_t reserved;
+} LogicalBallObservation;
+
+// env_count games of the given map, seeds may be NULL to use 1, 2, 3, ...
+// NULL if there is no such map.
+// thread_count threads are shared by all handles of the process and stopped
+// when the last handle is destroyed, which has to happen before the library is
+// unloaded. Logging is switched off, it would slow the games down to a crawl.
+LOGICAL_ENV_API LogicalEnvs *logical_create(int32_t env_count, int32_t map_number, const uint32_t *seeds, int32_t thread_count);
+LOGICAL_ENV_API void logical_destroy(LogicalEnvs *envs);
+LOGICAL_ENV_API int32_t logical_env_count(const LogicalEnvs *envs);
+
+// start the games over where mask is non-zero, all of them if mask is NULL
+LOGICAL_ENV_API void logical_reset(LogicalEnvs *envs, const uint8_t *mask);
+
+// actions holds action_counts[0] actions for the first game, then
+// action_counts[1] for the second one and so on. They are applied before the
+// first of tick_count ticks. action_counts may be NULL if there are none.
+LOGICAL_ENV_API void logical_step(LogicalEnvs *envs, const LogicalAction *actions, const int32_t *action_counts, int32_t tick_count);
+
+// bytes per game written by logical_observe
+LOGICAL_ENV_API int64_t logical_observation_size(void);
+// write env_count observations one after the other into buffer
+LOGICAL_ENV_API void logical_observe(const LogicalEnvs *envs, void *buffer);
+
+// Draw every game like the game window does, into env_count images of
+// width * height pixels one after the other. A pixel is 4 bytes of red, green,
+// blue and alpha, rows go from top to bottom, the whole map is fitted into the
+// image. Small sizes like 84 x 84 are what this is meant for.
+LOGICAL_ENV_API void logical_render(const LogicalEnvs *envs, int32_t width, int32_t height, void *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ENV_HPP_
@@ -0,0 +1,34 @@
+#include "logical.hpp"
+
+// Game events go into a ring of the last NEVENTS events of every game, one
+// per game so that games on different threads never share one. The game
+// only writes them while somebody is subscribed, so emitEvent costs a single
+// check otherwise. Subscribers read whatever is new after a tick, all at once.
+
+void subscribeEvents(GameData *gd, EventCursor *cursor) {
+	++gd->event_subscribers;
+	cursor->position = gd->event_head;
+	cursor->missed = 0;
+}
+
+void unsubscribeEvents(GameData *gd, EventCursor *cursor) {
+	SDL_assert(gd->event_subscribers > 0);
+	--gd->event_subscribers;
+	cursor->position = gd->event_head;
+}
+
+int readEvents(const GameData *gd, EventCursor *cursor, GameEvent *events, int max_count) {
+	uint32 available = gd->event_head - cursor->position;
+	if (available > NEVENTS) {
+		// too slow, skip what is gone already
+		cursor->missed += available - NEVENTS;
+		cursor->position = gd->event_head - NEVENTS;
+		available = NEVENTS;
+	}
+	int count = (int)SDL_min(available, (uint32)max_count);
+	for (int i = 0; i < count; ++i) {
+		events[i] = gd->events[(cursor->position + i) % NEVENTS];
+	}
+	cursor->position += count;
+	return count;
+}
@@ -1,6 +1,19 @@
 #include "logical.hpp"
 
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#if defined(LOGICAL_SSE2)
+	#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+using namespace std;
 
 const int ROTOR_POSITIONS[] = {
 	ROTOR_POSITION_RIGHT,
@@ -9,6 +22,13 @@ const int ROTOR_POSITIONS[] = {
 	ROTOR_POSITION_BOTTOM,
 };
 
+// speed of balls on lines, in pixels per second
+const int LINE_VELOCITY = 160;
+
+// where a ball in a rotor sits relative to its center, by position
+static const float ROTOR_OFFSET_X[4] = { +15.0f, 0.0f, -15.0f, 0.0f };
+static const float ROTOR_OFFSET_Y[4] = { 0.0f, -15.0f, 0.0f, +15.0f };
+
 void clearGame(GameData *gd) {
 	for (int i = 0; i < NBALLS; ++i) {
 		gd->balls[i].type = BALL_TYPE_NONE;
@@ -23,6 +43,9 @@ void clearGame(GameData *gd) {
 	gd->ball_count = 0;
 
 	gd->ball_type_index_next = 0;
+	gd->ball_last_added = -1;
+	gd->ball_end = 0;
+	memset(gd->ball_buckets, 0, sizeof(gd->ball_buckets));
 
 	gd->time = 0;
 }
@@ -49,9 +72,14 @@ int addBall(GameData *gd, int type) {
 		gd->balls[ball_index].created = gd->time;
 		gd->balls[ball_index].released_counter = 0;
 		gd->balls[ball_index].spawn_index = -1;
+		gd->balls[ball_index].has_prev = false;
+		gd->ball_last_added = ball_index;
+		gd->ball_end = SDL_max(gd->ball_end, ball_index + 1);
+		countMetric(&metrics.balls_allocated);
 		SDL_Log("Allocated ball %d (type %d)", ball_index, type);
 		return ball_index;
 	} else {
+		countMetric(&metrics.ball_allocation_failures);
 		SDL_Log("Allocating ball failed, already full");
 		return -1;
 	}
@@ -59,7 +87,12 @@ int addBall(GameData *gd, int type) {
 
 void removeBall(GameData *gd, int ball_index) {
 	if (gd->balls[ball_index].type != BALL_TYPE_NONE) {
+		if (gd->balls[ball_index].connector.type == CONNECTOR_LINE) {
+			dequeueBallFromLine(gd, ball_index);
+		}
 		gd->balls[ball_index].type = BALL_TYPE_NONE;
+		updateBallBucket(gd, ball_index);
+		countMetric(&metrics.balls_freed);
 		SDL_Log("Released ball %d", ball_index);
 	}
 }
@@ -108,7 +141,12 @@ int placeBallFree(GameData *gd, int ball_type, float x, float y, float vx, float
 		gd->balls[ball_index].y = y;
 		gd->balls[ball_index].vx = vx;
 		gd->balls[ball_index].vy = vy;
+		gd->balls[ball_index].fixed_x = toFixed(x);
+		gd->balls[ball_index].fixed_y = toFixed(y);
+		gd->balls[ball_index].fixed_vx = toFixed(vx);
+		gd->balls[ball_index].fixed_vy = toFixed(vy);
 		gd->balls[ball_index].connector.type = CONNECTOR_FREE;
+		updateBallBucket(gd, ball_index);
 	}
 	return ball_index;
 }
@@ -117,16 +155,23 @@ int placeBallInRotor(GameData *gd, int ball_type, int rotor_index, int rotor_pos
 	// rotor position needs to be empty
 	SDL_assert(gd->rotors[rotor_index].balls[rotor_position] == -1);
 	int ball_index = addBall(gd, ball_type);
+	if (ball_index < 0)
+		return -1;
 	gd->balls[ball_index].connector.type = CONNECTOR_ROTOR;
 	gd->balls[ball_index].connector.target = rotor_index;
 	gd->balls[ball_index].connector.rotor.position = rotor_position;
+	updateBallBucket(gd, ball_index);
+	setRotorBall(gd, rotor_index, rotor_position, ball_index);
 	return ball_index;
 }
 
 int placeBallInSpawn(GameData *gd, int ball_type, int spawn_index) {
 	int ball_index = addBall(gd, ball_type);
+	if (ball_index < 0)
+		return -1;
 	gd->balls[ball_index].connector.type = CONNECTOR_SPAWN;
 	gd->balls[ball_index].connector.target = spawn_index;
+	updateBallBucket(gd, ball_index);
 	return ball_index;
 }
 
@@ -140,59 +185,44 @@ int placeRandomBallInSpawn(GameData *gd, int spawn_index) {
 void changeBallConnector(GameData *gd, int ball_index, const Connector *connector) {
 	SDL_assert(connector != NULL);
 	copyConnector(connector, &gd->balls[ball_index].connector);
+	updateBallBucket(gd, ball_index);
 	if (connector->type == CONNECTOR_LINE) {
 		int line_index = connector->target;
 		gd->balls[ball_index].x = gd->lines[line_index].x1;
 		gd->balls[ball_index].y = gd->lines[line_index].y1;
+		gd->balls[ball_index].fixed_x = gd->lines[line_index].fixed_x1;
+		gd->balls[ball_index].fixed_y = gd->lines[line_index].fixed_y1;
+		gd->balls[ball_index].line_progress = 0;
+		enqueueBallOnLine(gd, ball_index, line_index);
+		emitEvent(gd, EVENT_BALL_ON_LINE, ball_index, line_index, -1);
 		SDL_Log("ball %d is now on line %d", ball_index, line_index);
 	} else if (connector->type == CONNECTOR_ROTOR) {
+		// where the ball is drawn follows from the rotor, see getBallPosition
 		int rotor_index = gd->balls[ball_index].connector.target;
 		int position = gd->balls[ball_index].connector.rotor.position;
+		setRotorBall(gd, rotor_index, position, ball_index);
 
-		float dx = 0;
-		float dy = 0;
-		if (position == ROTOR_POSITION_RIGHT) {
-			dx = +15.0;
-		} else if (position == ROTOR_POSITION_TOP) {
-			dy = -15.0;
-		} else if (position == ROTOR_POSITION_LEFT) {
-			dx = -15.0;
-		} else if (position == ROTOR_POSITION_BOTTOM) {
-			dy = +15.0;
-		}
-
-		gd->balls[ball_index].x = gd->rotors[rotor_index].x + dx;
-		gd->balls[ball_index].y = gd->rotors[rotor_index].y + dy;
-
-		gd->rotors[rotor_index].balls[position] = ball_index;
-
+		emitEvent(gd, EVENT_BALL_IN_ROTOR, ball_index, rotor_index, position);
 		SDL_Log("ball %d is now on rotor %d(%d)", ball_index, rotor_index, position);
 
 		if (gd->balls[ball_index].released_counter == 0) {
 			placeRandomBallInSpawn(gd, gd->balls[ball_index].spawn_index);
 		}
 
-		if (gd->rotors[rotor_index].balls[0] != -1) {
-			int ball_index = gd->rotors[rotor_index].balls[0];
-			int ball_type = gd->balls[ball_index].type;
-			bool all_identical = true;
-			for (int i = 1; i < 4; ++i) {
-				int ball_index_other = gd->rotors[rotor_index].balls[i];
-				int ball_type_other = gd->balls[ball_index_other].type;
-				if (ball_type != ball_type_other) {
-					all_identical = false;
-					break;
-				}
-			}
-			if (all_identical) {
-				for (int i = 0; i < 4; ++i) {
-					int ball_index = gd->rotors[rotor_index].balls[i];
-					removeBall(gd, ball_index);
-					gd->rotors[rotor_index].balls[i] = -1;
-				}
-				gd->rotors[rotor_index].destroyed = true;
-				SDL_Log("rotor %d destroyed", rotor_index);
+		// four times the same byte, and an empty position never matches
+		uint32 slots = gd->rotors[rotor_index].slots;
+		uint32 first = slots & 0xFF;
+		if (first != 0 && slots == first * 0x01010101u) {
+			int ball_type = (int)first - 1;
+			for (int i = 0; i < 4; ++i) {
+				removeBall(gd, gd->rotors[rotor_index].balls[i]);
+				gd->rotors[rotor_index].balls[i] = -1;
 			}
+			gd->rotors[rotor_index].slots = 0;
+			gd->rotors[rotor_index].destroyed = true;
+			countMetric(&metrics.rotors_destroyed);
+			emitEvent(gd, EVENT_ROTOR_DESTROYED, -1, rotor_index, ball_type);
+			SDL_Log("rotor %d destroyed", rotor_index);
 		}
 	}
 }
@@ -208,69 +238,369 @@ void copyConnector(const Connector *src, Connector *dst) {
 }
 
 void turnRotor(GameData *gd, int rotor_index, int direction) {
-	int *balls = gd->rotors[rotor_index].balls;
-	// update rotor
+	Rotor *rotor = &gd->rotors[rotor_index];
+	// position n gets the ball of position n + shift, byte n of slots is position n
+	int shift;
 	if (direction == ROTOR_CLOCKWISE) {
-		int temp = balls[ROTOR_POSITION_RIGHT];
-		balls[ROTOR_POSITION_RIGHT] = balls[ROTOR_POSITION_TOP];
-		balls[ROTOR_POSITION_TOP] = balls[ROTOR_POSITION_LEFT];
-		balls[ROTOR_POSITION_LEFT] = balls[ROTOR_POSITION_BOTTOM];
-		balls[ROTOR_POSITION_BOTTOM] = temp;
+		rotor->slots = (rotor->slots >> 8) | (rotor->slots << 24);
+		shift = 1;
 		SDL_Log("Rotor %d was turned clockwise", rotor_index);
 	} else if (direction == ROTOR_ANTICLOCKWISE) {
-		int temp = balls[ROTOR_POSITION_RIGHT];
-		balls[ROTOR_POSITION_RIGHT] = balls[ROTOR_POSITION_BOTTOM];
-		balls[ROTOR_POSITION_BOTTOM] = balls[ROTOR_POSITION_LEFT];
-		balls[ROTOR_POSITION_LEFT] = balls[ROTOR_POSITION_TOP];
-		balls[ROTOR_POSITION_TOP] = temp;
+		rotor->slots = (rotor->slots << 8) | (rotor->slots >> 24);
+		shift = 3;
 		SDL_Log("Rotor %d was turned anticlockwise", rotor_index);
 	} else {
 		SDL_LogWarn(0, "Rotor %d illegal turn direction (%d)", rotor_index, direction);
 		return;
 	}
 
-	// update balls
-	for (int dir = 0; dir < 4; ++dir) {
-		int ball_index = balls[ROTOR_POSITIONS[dir]];
+	// balls only keep their position, where they are drawn follows from that
+	int balls[4];
+	memcpy(balls, rotor->balls, sizeof(balls));
+	for (int pos = 0; pos < 4; ++pos) {
+		int ball_index = balls[(pos + shift) & 3];
+		rotor->balls[pos] = ball_index;
 		if (ball_index >= 0) {
-			gd->balls[ball_index].connector.rotor.position = ROTOR_POSITIONS[dir];
-			updateBallPosition(gd, ball_index);
+			gd->balls[ball_index].connector.rotor.position = pos;
 		}
 	}
+
+	emitEvent(gd, EVENT_ROTOR_TURNED, -1, rotor_index, direction);
 }
 
 void releaseBallFromRotor(GameData *gd, int rotor_index, int position) {
 	int ball_index = gd->rotors[rotor_index].balls[position];
-	if (ball_index >= 0 && gd->rotors[rotor_index].connectors[position].type != CONNECTOR_WALL) {
+	const Connector *connector = &gd->rotors[rotor_index].connectors[position];
+	if (ball_index >= 0 && connector->type != CONNECTOR_WALL && canEnterConnector(gd, connector)) {
+		// parked balls have no position of their own, a free ball starts from its slot
+		getBallPosition(gd, ball_index, &gd->balls[ball_index].x, &gd->balls[ball_index].y);
 		changeBallConnector(gd, ball_index, &gd->rotors[rotor_index].connectors[position]);
 		gd->balls[ball_index].released_counter++;
-		gd->rotors[rotor_index].balls[position] = -1;
+		setRotorBall(gd, rotor_index, position, -1);
+		emitEvent(gd, EVENT_BALL_RELEASED, ball_index, rotor_index, position);
 		SDL_Log("Released ball %d from rotor %d(%d)", ball_index, rotor_index, position);
 	}
 }
 
-void updateBallPosition(GameData *gd, int ball_index) {
-	if (gd->balls[ball_index].connector.type == CONNECTOR_ROTOR) {
-		int rotor_index = gd->balls[ball_index].connector.target;
-		int position = gd->balls[ball_index].connector.rotor.position;
+void applyAction(GameData *gd, const Action *action) {
+	// actions may come from bots, check them before touching anything
+	if (action->type == ACTION_TURN_ROTOR) {
+		if (action->target >= 0 && action->target < gd->rotor_count && (action->argument == ROTOR_CLOCKWISE || action->argument == ROTOR_ANTICLOCKWISE))
+			turnRotor(gd, action->target, action->argument);
+	} else if (action->type == ACTION_RELEASE_BALL) {
+		if (action->target >= 0 && action->target < gd->rotor_count && action->argument >= 0 && action->argument < 4)
+			releaseBallFromRotor(gd, action->target, action->argument);
+	} else if (action->type == ACTION_RESET) {
+		resetGame(gd);
+	} else if (action->type == ACTION_SPAWN_BALL) {
+		if (action->target >= 0 && action->target < gd->spawn_count && action->argument >= 0 && action->argument <= BALL_TYPE_WHITE)
+			placeBallInSpawn(gd, action->argument, action->target);
+	}
+}
+
+static int getBallBucket(const Ball *ball) {
+	if (ball->type == BALL_TYPE_NONE)
+		return -1;
+	if (ball->connector.type == CONNECTOR_LINE)
+		return BALL_BUCKET_LINE;
+	if (ball->connector.type == CONNECTOR_FREE)
+		return BALL_BUCKET_FREE;
+	if (ball->connector.type == CONNECTOR_ROTOR)
+		return BALL_BUCKET_ROTOR;
+	return BALL_BUCKET_PENDING;
+}
+
+// Live balls sit in buckets by their connector, so a tick only visits the
+// ones that can move and never the many that wait in rotors. Called whenever
+// a ball is added, removed or changes its connector.
+void updateBallBucket(GameData *gd, int ball_index) {
+	int word = ball_index / 64;
+	uint64 bit = (uint64)1 << (ball_index % 64);
+	for (int i = 0; i < BALL_BUCKETS; ++i) {
+		gd->ball_buckets[i][word] &= ~bit;
+	}
+	int bucket = getBallBucket(&gd->balls[ball_index]);
+	if (bucket >= 0) {
+		gd->ball_buckets[bucket][word] |= bit;
+	}
+}
+
+// after the map got built or a snapshot unpacked, which set connectors directly
+void rebuildBallBuckets(GameData *gd) {
+	memset(gd->ball_buckets, 0, sizeof(gd->ball_buckets));
+	for (int i = 0; i < gd->ball_end; ++i) {
+		int bucket = getBallBucket(&gd->balls[i]);
+		if (bucket >= 0) {
+			gd->ball_buckets[bucket][i / 64] |= (uint64)1 << (i % 64);
+		}
+	}
+}
+
+static int lowestBit(uint64 bits) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return (int)index;
+#elif defined(__GNUC__)
+	return __builtin_ctzll(bits);
+#else
+	int index = 0;
+	while ((bits & 1) == 0) {
+		bits >>= 1;
+		++index;
+	}
+	return index;
+#endif
+}
+
+// the first ball from index from on that is on a line, free, or in a spawn or inserter, end if there is none before it
+int findMovingBall(const GameData *gd, int from, int end) {
+	if (from >= end)
+		return end;
+	int word = from / 64;
+	uint64 bits = gd->ball_buckets[BALL_BUCKET_LINE][word] | gd->ball_buckets[BALL_BUCKET_FREE][word] | gd->ball_buckets[BALL_BUCKET_PENDING][word];
+	bits &= ~(uint64)0 << (from % 64);
+	while (bits == 0) {
+		++word;
+		if (word * 64 >= end)
+			return end;
+		bits = gd->ball_buckets[BALL_BUCKET_LINE][word] | gd->ball_buckets[BALL_BUCKET_FREE][word] | gd->ball_buckets[BALL_BUCKET_PENDING][word];
+	}
+	return SDL_min(word * 64 + lowestBit(bits), end);
+}
 
-		float dx = 0;
-		float dy = 0;
-		if (position == ROTOR_POSITION_RIGHT) {
-			dx = +15.0;
-		} else if (position == ROTOR_POSITION_TOP) {
-			dy = -15.0;
-		} else if (position == ROTOR_POSITION_LEFT) {
-			dx = -15.0;
-		} else if (position == ROTOR_POSITION_BOTTOM) {
-			dy = +15.0;
+// the only way balls get into and out of rotors, keeps slots in step with balls
+void setRotorBall(GameData *gd, int rotor_index, int position, int ball_index) {
+	Rotor *rotor = &gd->rotors[rotor_index];
+	uint32 slot = ball_index >= 0 ? (uint32)(gd->balls[ball_index].type + 1) : 0;
+	rotor->balls[position] = ball_index;
+	rotor->slots = (rotor->slots & ~(0xFFu << (8 * position))) | (slot << (8 * position));
+}
+
+// Balls in rotors do not keep x and y up to date, turning a rotor would have
+// to move all of them. Whoever draws or exports a ball asks here instead.
+void getBallPosition(const GameData *gd, int ball_index, float *x, float *y) {
+	const Ball *ball = &gd->balls[ball_index];
+	if (ball->connector.type == CONNECTOR_ROTOR) {
+		const Rotor *rotor = &gd->rotors[ball->connector.target];
+		int position = ball->connector.rotor.position;
+		*x = rotor->x + ROTOR_OFFSET_X[position];
+		*y = rotor->y + ROTOR_OFFSET_Y[position];
+	} else {
+		*x = ball->x;
+		*y = ball->y;
+	}
+}
+
+// how many balls of the most common type a rotor holds, 0 if it is empty
+static uint8 countRotorMatch(uint32 slots) {
+	int most = 0;
+	for (int i = 0; i < 4; ++i) {
+		uint32 type = (slots >> (8 * i)) & 0xFF;
+		if (type == 0)
+			continue;
+		int count = 0;
+		for (int k = 0; k < 4; ++k) {
+			count += ((slots >> (8 * k)) & 0xFF) == type;
 		}
+		most = SDL_max(most, count);
+	}
+	return (uint8)most;
+}
 
-		gd->balls[ball_index].x = gd->rotors[rotor_index].x + dx;
-		gd->balls[ball_index].y = gd->rotors[rotor_index].y + dy;
+// For every rotor, how many of its balls share the most common type. Three
+// means a rotor is one ball away from being destroyed. Four rotors at a time
+// with SSE2, one 32 bit lane each: every byte gets compared to the other three
+// bytes of its lane, the matches summed up and the largest sum kept.
+void countRotorMatches(const GameData *gd, uint8 *counts) {
+	int i = 0;
+#if defined(LOGICAL_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(1);
+	for (; i + 4 <= gd->rotor_count; i += 4) {
+		uint32 slots[4] = { gd->rotors[i].slots, gd->rotors[i + 1].slots, gd->rotors[i + 2].slots, gd->rotors[i + 3].slots };
+		__m128i v = _mm_loadu_si128((const __m128i *)slots);
+		__m128i turned_1 = _mm_or_si128(_mm_srli_epi32(v, 8), _mm_slli_epi32(v, 24));
+		__m128i turned_2 = _mm_or_si128(_mm_srli_epi32(v, 16), _mm_slli_epi32(v, 16));
+		__m128i turned_3 = _mm_or_si128(_mm_srli_epi32(v, 24), _mm_slli_epi32(v, 8));
+		// equal bytes are -1, subtracting counts them
+		__m128i count = _mm_sub_epi8(ones, _mm_cmpeq_epi8(v, turned_1));
+		count = _mm_sub_epi8(count, _mm_cmpeq_epi8(v, turned_2));
+		count = _mm_sub_epi8(count, _mm_cmpeq_epi8(v, turned_3));
+		count = _mm_andnot_si128(_mm_cmpeq_epi8(v, zero), count);
+		count = _mm_max_epu8(count, _mm_srli_epi32(count, 16));
+		count = _mm_max_epu8(count, _mm_srli_epi32(count, 8));
+		count = _mm_and_si128(count, _mm_set1_epi32(0xFF));
+		count = _mm_packus_epi16(_mm_packs_epi32(count, zero), zero);
+		uint32 packed = (uint32)_mm_cvtsi128_si32(count);
+		memcpy(counts + i, &packed, 4);
+	}
+#endif
+	for (; i < gd->rotor_count; ++i) {
+		counts[i] = countRotorMatch(gd->rotors[i].slots);
+	}
+}
+
+// called before a tick, so drawing can interpolate between the old and new positions
+void rememberBallPositions(GameData *gd) {
+	// addBall clears has_prev of every new ball
+	for (int i = 0; i < gd->ball_end; ++i) {
+		Ball *ball = &gd->balls[i];
+		if (ball->type == BALL_TYPE_NONE)
+			continue;
+		getBallPosition(gd, i, &ball->prev_x, &ball->prev_y);
+		ball->has_prev = true;
 	}
 }
 
+int32 toFixed(float value) {
+	// exact in double, so it rounds the same everywhere
+	return (int32)floor((double)value * (1 << FIXED_SHIFT) + 0.5);
+}
+
+float fromFixed(int32 value) {
+	return value * (1.0f / (1 << FIXED_SHIFT));
+}
+
+static uint64 isqrt64(uint64 value) {
+	uint64 result = 0;
+	uint64 bit = (uint64)1 << 62;
+	while (bit > value) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		} else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+	return result;
+}
+
+// the fixed-point versions of the line geometry, needed before any ball moves
+void prepareFixedLines(GameData *gd) {
+	for (int i = 0; i < gd->line_count; ++i) {
+		Line *line = &gd->lines[i];
+		line->fixed_x1 = toFixed(line->x1);
+		line->fixed_y1 = toFixed(line->y1);
+		int64 line_x = (int64)toFixed(line->x2) - line->fixed_x1;
+		int64 line_y = (int64)toFixed(line->y2) - line->fixed_y1;
+		int64 length = (int64)isqrt64((uint64)(line_x * line_x + line_y * line_y));
+		line->fixed_length = (int32)length;
+		line->fixed_dir_x = length > 0 ? (int32)(line_x * ((int64)1 << FIXED_DIR_SHIFT) / length) : 0;
+		line->fixed_dir_y = length > 0 ? (int32)(line_y * ((int64)1 << FIXED_DIR_SHIFT) / length) : 0;
+	}
+}
+
+// Maps put some balls straight onto lines by their position, their distance
+// along the line and fixed-point position come from projecting it.
+void prepareLineBalls(GameData *gd) {
+	for (int i = 0; i < gd->ball_end; ++i) {
+		Ball *ball = &gd->balls[i];
+		if (ball->type == BALL_TYPE_NONE || ball->connector.type != CONNECTOR_LINE)
+			continue;
+		const Line *line = &gd->lines[ball->connector.target];
+		int64 ball_x = (int64)toFixed(ball->x) - line->fixed_x1;
+		int64 ball_y = (int64)toFixed(ball->y) - line->fixed_y1;
+		int64 progress = (ball_x * line->fixed_dir_x + ball_y * line->fixed_dir_y) >> FIXED_DIR_SHIFT;
+		if (progress < 0) {
+			progress = 0;
+		} else if (progress > line->fixed_length) {
+			progress = line->fixed_length;
+		}
+		ball->line_progress = (int32)progress;
+		ball->fixed_x = line->fixed_x1 + (int32)((line->fixed_dir_x * progress) >> FIXED_DIR_SHIFT);
+		ball->fixed_y = line->fixed_y1 + (int32)((line->fixed_dir_y * progress) >> FIXED_DIR_SHIFT);
+	}
+}
+
+// integers only, the ball keeps its distance along the line instead of projecting its position
+static bool moveBallAlongLineFixed(GameData *gd, int ball_index, Time t) {
+	Ball *ball = &gd->balls[ball_index];
+	const Line *line = &gd->lines[ball->connector.target];
+	int64 progress = ball->line_progress + (int64)LINE_VELOCITY * t * (1 << FIXED_SHIFT) / seconds(1);
+	if (progress > line->fixed_length) {
+		return true;
+	}
+	ball->line_progress = (int32)progress;
+	ball->fixed_x = line->fixed_x1 + (int32)((line->fixed_dir_x * progress) >> FIXED_DIR_SHIFT);
+	ball->fixed_y = line->fixed_y1 + (int32)((line->fixed_dir_y * progress) >> FIXED_DIR_SHIFT);
+	ball->x = fromFixed(ball->fixed_x);
+	ball->y = fromFixed(ball->fixed_y);
+	return false;
+}
+
+// moves a ball along its line, returns true instead if it would pass the end
+bool moveBallAlongLine(GameData *gd, int ball_index, Time t) {
+	if (gd->fixed_point) {
+		return moveBallAlongLineFixed(gd, ball_index, t);
+	}
+	int line_index = gd->balls[ball_index].connector.target;
+	// line vector
+	float line_x = gd->lines[line_index].x2 - gd->lines[line_index].x1;
+	float line_y = gd->lines[line_index].y2 - gd->lines[line_index].y1;
+	// length of line vector
+	float line_norm = sqrt(line_x * line_x + line_y * line_y);
+	// line vector direction
+	float dir_x = line_x / line_norm;
+	float dir_y = line_y / line_norm;
+	// ball position relative to line start
+	float ball_x = gd->balls[ball_index].x - gd->lines[line_index].x1;
+	float ball_y = gd->balls[ball_index].y - gd->lines[line_index].y1;
+	// projection value of ball position onto line
+	float proj = ball_x * dir_x + ball_y * dir_y;
+	// move ball along line
+	float dt = t / (float)seconds(1);
+	float velocity = (float)LINE_VELOCITY;
+	float new_proj = proj + velocity * dt;
+	// check whether the ball reached the end of the line
+	if (new_proj > line_norm) {
+		return true;
+	}
+	float new_x = gd->lines[line_index].x1 + dir_x * new_proj;
+	float new_y = gd->lines[line_index].y1 + dir_y * new_proj;
+	gd->balls[ball_index].x = new_x;
+	gd->balls[ball_index].y = new_y;
+	return false;
+}
+
+// hands a ball at the end of its line over to whatever the line leads to
+void finishBallOnLine(GameData *gd, int ball_index) {
+	int line_index = gd->balls[ball_index].connector.target;
+	const Connector *connector = &gd->lines[line_index].connector;
+	if (connector->type == CONNECTOR_ROTOR) {
+		int rotor_index = connector->target;
+		int rotor_position = connector->rotor.position;
+		bool is_free = gd->rotors[rotor_index].balls[rotor_position] == -1;
+		if (!is_free) {
+			connector = &gd->rotors[rotor_index].connectors[rotor_position];
+		}
+	}
+	// with spacing the ball waits at the end until there is room
+	if (!canEnterConnector(gd, connector))
+		return;
+	dequeueBallFromLine(gd, ball_index);
+	changeBallConnector(gd, ball_index, connector);
+}
+
+// moves a free ball by one tick of its velocity, returns true if it is old enough to decay
+bool moveFreeBall(GameData *gd, int ball_index) {
+	Ball *ball = &gd->balls[ball_index];
+	if (gd->fixed_point) {
+		ball->fixed_x += ball->fixed_vx;
+		ball->fixed_y += ball->fixed_vy;
+		ball->x = fromFixed(ball->fixed_x);
+		ball->y = fromFixed(ball->fixed_y);
+		return gd->time - ball->created > seconds(20);
+	}
+	gd->balls[ball_index].x += gd->balls[ball_index].vx;
+	gd->balls[ball_index].y += gd->balls[ball_index].vy;
+	return gd->time - gd->balls[ball_index].created > seconds(20);
+}
+
 void progressBall(GameData *gd, int ball_index, Time t) {
 	while (gd->balls[ball_index].type != BALL_TYPE_NONE) {
 		// spawns are where new balls are created
@@ -278,6 +608,9 @@ void progressBall(GameData *gd, int ball_index, Time t) {
 			// remember the index of the spawn of this ball for later
 			int spawn_index = gd->balls[ball_index].connector.target;
 			gd->balls[ball_index].spawn_index = spawn_index;
+			// with spacing the ball stays in the spawn until the line has room
+			if (!canEnterConnector(gd, &gd->spawns[spawn_index].connector))
+				break;
 			// put the ball onto the first line (or something else)
 			changeBallConnector(gd, ball_index, &gd->spawns[spawn_index].connector);
 			continue;
@@ -287,108 +620,258 @@ void progressBall(GameData *gd, int ball_index, Time t) {
 		if (gd->balls[ball_index].connector.type == CONNECTOR_INSERTER) {
 			// find whatever we are trying to insert into
 			int inserter_index = gd->balls[ball_index].connector.target;
-			const Connector *connector_success = &gd->inserters[inserter_index].connector_success;
-			if (connector_success->type == CONNECTOR_ROTOR) {
+			const Connector *connector = &gd->inserters[inserter_index].connector_success;
+			if (connector->type == CONNECTOR_ROTOR) {
 				// check if the rotor is free
-				int rotor_index = connector_success->target;
-				int rotor_position = connector_success->rotor.position;
+				int rotor_index = connector->target;
+				int rotor_position = connector->rotor.position;
 				bool is_free = gd->rotors[rotor_index].balls[rotor_position] == -1;
-				if (is_free) {
-					// put the ball into the rotor
-					changeBallConnector(gd, ball_index, connector_success);
-				} else {
+				if (!is_free) {
 					// put the ball on something else instead
-					const Connector *connector_failure = &gd->inserters[inserter_index].connector_failure;
-					changeBallConnector(gd, ball_index, connector_failure);
+					connector = &gd->inserters[inserter_index].connector_failure;
 				}
-			} else {
-				// if we are trying to insert into something else then a rotor, it always succeeds
-				changeBallConnector(gd, ball_index, connector_success);
 			}
+			// if we are trying to insert into something else then a rotor, it always succeeds,
+			// unless spacing keeps the ball waiting in the inserter
+			if (!canEnterConnector(gd, connector))
+				break;
+			changeBallConnector(gd, ball_index, connector);
 			// we may have inserted into another inserter, so keep going
 			continue;
 		}
 
 		// lines go from one place to another
 		if (gd->balls[ball_index].connector.type == CONNECTOR_LINE) {
-			int line_index = gd->balls[ball_index].connector.target;
-			// line vector
-			float line_x = gd->lines[line_index].x2 - gd->lines[line_index].x1;
-			float line_y = gd->lines[line_index].y2 - gd->lines[line_index].y1;
-			// length of line vector
-			float line_norm = sqrt(line_x * line_x + line_y * line_y);
-			// line vector direction
-			float dir_x = line_x / line_norm;
-			float dir_y = line_y / line_norm;
-			// ball position relative to line start
-			float ball_x = gd->balls[ball_index].x - gd->lines[line_index].x1;
-			float ball_y = gd->balls[ball_index].y - gd->lines[line_index].y1;
-			// projection value of ball position onto line
-			float proj = ball_x * dir_x + ball_y * dir_y;
-			// move ball along line
-			float dt = t / (float)seconds(1);
-			float velocity = 160.0; // pixels per second
-			float new_proj = proj + velocity * dt;
-			// check whether the ball reached the end of the line
-			if (new_proj > line_norm) {
-				const Connector *connector_success = &gd->lines[line_index].connector;
-				if (connector_success->type == CONNECTOR_ROTOR) {
-					int rotor_index = connector_success->target;
-					int rotor_position = connector_success->rotor.position;
-					bool is_free = gd->rotors[rotor_index].balls[rotor_position] == -1;
-					if (is_free) {
-						changeBallConnector(gd, ball_index, connector_success);
-					} else {
-						const Connector *connector_failure = &gd->rotors[rotor_index].connectors[rotor_position];
-						changeBallConnector(gd, ball_index, connector_failure);
-					}
-				} else {
-					changeBallConnector(gd, ball_index, connector_success);
+			if (gd->line_spacing) {
+				// moveLineQueues moved it already, only the first ball can be at the end
+				const LineQueue *queue = &gd->line_queues[gd->balls[ball_index].connector.target];
+				if (queue->first == ball_index && queue->first_waiting) {
+					finishBallOnLine(gd, ball_index);
 				}
-			} else {
-				float new_x = gd->lines[line_index].x1 + dir_x * new_proj;
-				float new_y = gd->lines[line_index].y1 + dir_y * new_proj;
-				gd->balls[ball_index].x = new_x;
-				gd->balls[ball_index].y = new_y;
+			} else if (moveBallAlongLine(gd, ball_index, t)) {
+				finishBallOnLine(gd, ball_index);
 			}
 			break;
 		}
 
 		if (gd->balls[ball_index].connector.type == CONNECTOR_FREE) {
-			gd->balls[ball_index].x += gd->balls[ball_index].vx;
-			gd->balls[ball_index].y += gd->balls[ball_index].vy;
-
-			if (gd->time - gd->balls[ball_index].created > seconds(20)) {
+			if (moveFreeBall(gd, ball_index)) {
+				emitEvent(gd, EVENT_BALL_DECAYED, ball_index, -1, gd->balls[ball_index].type);
 				SDL_Log("Ball %i decayed", ball_index);
 				removeBall(gd, ball_index);
 			}
 			break;
 		}
 
-		// balls in rotors do nothing
-		if (gd->balls[ball_index].connector.type == CONNECTOR_ROTOR) {
-			break;
-		}
+		// balls in rotors do nothing, neither do balls stuck at a wall
+		break;
 	}
 }
 
 void progressLogic(GameData *gd, Time t) {
-	for (int i = 0; i < NBALLS; ++i) {
+	Time start = getCurrentTime();
+	if (gd->line_spacing) {
+		moveLineQueues(gd, t);
+	}
+	// in the order of their index, a ball added with a higher index than the
+	// one being progressed still gets its turn during this tick
+	for (int i = findMovingBall(gd, 0, NBALLS); i < NBALLS; i = findMovingBall(gd, i + 1, NBALLS)) {
 		progressBall(gd, i, t);
 	}
 
 	gd->time += t;
+	countMetric(&metrics.ticks);
+	observeDuration(&metrics.tick_duration, getCurrentTime() - start);
+}
+
+// Built-in maps come out the same on every reset, only the balls in the spawns
+// depend on the seed. The first reset of such a map builds it and keeps what it
+// got, every later reset copies that back instead of building the map again.
+struct MapImage {
+	vector<Ball> balls;
+	vector<Rotor> rotors;
+	vector<Line> lines;
+	vector<LineQueue> line_queues;
+	vector<Inserter> inserters;
+	vector<Spawn> spawns;
+	int ball_count;
+	int ball_type_count;
+	int ball_types[NUM_BALL_TYPES];
+	int ball_type_index_next;
+	int ball_last_added;
+	// every game reset from the image has the same map
+	uint32 map_id;
+};
+
+// by built-in map number, made once and kept until the process ends
+static atomic<MapImage *> map_images[MAP_COUNT + 1];
+static mutex map_images_mutex;
+
+template<typename T>
+static void copyItems(T *to, const vector<T> &from) {
+	if (!from.empty()) {
+		memcpy(to, &from[0], from.size() * sizeof(T));
+	}
+}
+
+static void storeMapImage(const GameData *gd) {
+	lock_guard<mutex> lock(map_images_mutex);
+	// several threads may have built the same map at once, the first one wins
+	if (map_images[gd->map_number].load() != NULL)
+		return;
+	MapImage *image = new MapImage;
+	image->balls.assign(gd->balls, gd->balls + gd->ball_end);
+	image->rotors.assign(gd->rotors, gd->rotors + gd->rotor_count);
+	image->lines.assign(gd->lines, gd->lines + gd->line_count);
+	image->line_queues.assign(gd->line_queues, gd->line_queues + gd->line_count);
+	image->inserters.assign(gd->inserters, gd->inserters + gd->inserter_count);
+	image->spawns.assign(gd->spawns, gd->spawns + gd->spawn_count);
+	image->ball_count = gd->ball_count;
+	image->ball_type_count = gd->ball_type_count;
+	memcpy(image->ball_types, gd->ball_types, sizeof(image->ball_types));
+	image->ball_type_index_next = gd->ball_type_index_next;
+	image->ball_last_added = gd->ball_last_added;
+	image->map_id = gd->map_id;
+	map_images[gd->map_number].store(image, memory_order_release);
+}
+
+// the same as clearGame and building the map, balls past ball_end are free already
+static void applyMapImage(GameData *gd, const MapImage *image) {
+	int ball_end = (int)image->balls.size();
+	for (int i = ball_end; i < gd->ball_end; ++i) {
+		gd->balls[i].type = BALL_TYPE_NONE;
+	}
+	copyItems(gd->balls, image->balls);
+	copyItems(gd->rotors, image->rotors);
+	copyItems(gd->lines, image->lines);
+	copyItems(gd->line_queues, image->line_queues);
+	copyItems(gd->inserters, image->inserters);
+	copyItems(gd->spawns, image->spawns);
+	gd->ball_end = ball_end;
+	gd->rotor_count = (int)image->rotors.size();
+	gd->line_count = (int)image->lines.size();
+	gd->inserter_count = (int)image->inserters.size();
+	gd->spawn_count = (int)image->spawns.size();
+	gd->ball_count = image->ball_count;
+	gd->ball_type_count = image->ball_type_count;
+	memcpy(gd->ball_types, image->ball_types, sizeof(gd->ball_types));
+	gd->ball_type_index_next = image->ball_type_index_next;
+	gd->ball_last_added = image->ball_last_added;
+	gd->map_id = image->map_id;
+	gd->time = 0;
 }
 
-void resetGame(GameData *gd) {
+int newGame(GameData *gd, int map_number, uint32 seed) {
+	gd->map_number = map_number;
+	gd->seed = seed;
+	// resetGame only frees the balls up to ball_end
 	clearGame(gd);
-	random_seed(&gd->random, 42);
-	buildMap4(gd);
+	return resetGame(gd);
+}
+
+// -1 if the map could not be built, the game is left empty then
+int resetGame(GameData *gd) {
+	static atomic<uint32> map_ids(0);
+	bool built_in = gd->map_number >= 1 && gd->map_number <= MAP_COUNT;
+	const MapImage *image = built_in ? map_images[gd->map_number].load(memory_order_acquire) : NULL;
+	random_seed(&gd->random, gd->seed);
+	if (image != NULL) {
+		applyMapImage(gd, image);
+		rebuildBallBuckets(gd);
+	} else {
+		clearGame(gd);
+		gd->map_id = ++map_ids;
+		if (buildMap(gd, gd->map_number) != 0) {
+			// whatever got built so far may be half connected
+			clearGame(gd);
+			return -1;
+		}
+		prepareFixedLines(gd);
+		prepareLineBalls(gd);
+		rebuildLineQueues(gd);
+		rebuildBallBuckets(gd);
+
+		addBallType(gd, BALL_TYPE_BLUE);
+		addBallType(gd, BALL_TYPE_GREEN);
+		addBallType(gd, BALL_TYPE_YELLOW);
+		addBallType(gd, BALL_TYPE_MAGENTA);
+		if (built_in) {
+			storeMapImage(gd);
+		}
+	}
 
-	addBallType(gd, BALL_TYPE_BLUE);
-	addBallType(gd, BALL_TYPE_GREEN);
-	addBallType(gd, BALL_TYPE_YELLOW);
-	addBallType(gd, BALL_TYPE_MAGENTA);
+	// generated maps can have more than one spawn, and loaded maps none
+	for (int i = 0; i < gd->spawn_count; ++i) {
+		placeRandomBallInSpawn(gd, i);
+	}
+	return 0;
+}
+
+// Forks are for lookahead and previews: keep a few GameData around and fork
+// into them over and over. Copying the map happens once per fork and map,
+// every later fork only copies what a tick can change, and only the balls up
+// to the last one in use. The source has to come from newGame or resetGame,
+// forks never get a window, renderer or event subscribers, and whatever the
+// fork owned before is not freed.
+void forkGame(GameData *fork, const GameData *source) {
+	if (fork->map_id != source->map_id) {
+		memcpy(fork->lines, source->lines, source->line_count * sizeof(Line));
+		memcpy(fork->inserters, source->inserters, source->inserter_count * sizeof(Inserter));
+		memcpy(fork->spawns, source->spawns, source->spawn_count * sizeof(Spawn));
+		fork->line_count = source->line_count;
+		fork->inserter_count = source->inserter_count;
+		fork->spawn_count = source->spawn_count;
+		fork->rotor_count = source->rotor_count;
+		fork->map_number = source->map_number;
+		fork->map_params = source->map_params;
+		memcpy(fork->map_path, source->map_path, sizeof(fork->map_path));
+		// the fork may be fresh memory or have been a game of its own before
+		fork->win = NULL;
+		fork->renderer = NULL;
+		fork->render_index = NULL;
+		fork->dirty_rects = false;
+		fork->full_redraw = true;
+		fork->interpolation = 1.0f;
+		fork->camera_x = source->camera_x;
+		fork->camera_y = source->camera_y;
+		fork->zoom = source->zoom;
+		fork->view_width = source->view_width;
+		fork->view_height = source->view_height;
+		fork->event_head = 0;
+		fork->event_subscribers = 0;
+		// whatever the fork held before is no longer valid
+		fork->ball_end = NBALLS;
+		fork->map_id = source->map_id;
+	}
 
-	placeRandomBallInSpawn(gd, 0);
+	// rotors keep their occupancy next to their position and connectors
+	memcpy(fork->rotors, source->rotors, source->rotor_count * sizeof(Rotor));
+	// ball_end only ever grows until the next reset, the tail may be free again
+	int ball_end = source->ball_end;
+	while (ball_end > 0 && source->balls[ball_end - 1].type == BALL_TYPE_NONE) {
+		--ball_end;
+	}
+	memcpy(fork->balls, source->balls, ball_end * sizeof(Ball));
+	for (int i = ball_end; i < fork->ball_end; ++i) {
+		fork->balls[i].type = BALL_TYPE_NONE;
+	}
+	// the source has no bits past its ball_end, the fork may have had some
+	int words = (SDL_max(ball_end, fork->ball_end) + 63) / 64;
+	for (int i = 0; i < BALL_BUCKETS; ++i) {
+		memcpy(fork->ball_buckets[i], source->ball_buckets[i], words * sizeof(uint64));
+	}
+	fork->ball_end = ball_end;
+	memcpy(fork->line_queues, source->line_queues, source->line_count * sizeof(LineQueue));
+
+	fork->ball_count = source->ball_count;
+	fork->ball_type_count = source->ball_type_count;
+	memcpy(fork->ball_types, source->ball_types, sizeof(fork->ball_types));
+	fork->ball_type_index_next = source->ball_type_index_next;
+	fork->ball_last_added = source->ball_last_added;
+	fork->time = source->time;
+	fork->random = source->random;
+	// games of the same built-in map share their map_id, but not their seed
+	fork->seed = source->seed;
+	fork->fixed_point = source->fixed_point;
+	fork->line_spacing = source->line_spacing;
 }
@@ -1,15 +1,10 @@
 #include "logical.hpp"
 
-const Uint8 BALL_COLORS[][4] = {
-	{   0,   0,   0, SDL_ALPHA_OPAQUE },
-	{ 255,   0,   0, SDL_ALPHA_OPAQUE },
-	{   0, 255,   0, SDL_ALPHA_OPAQUE },
-	{   0,   0, 255, SDL_ALPHA_OPAQUE },
-	{   0, 255, 255, SDL_ALPHA_OPAQUE },
-	{ 255,   0, 255, SDL_ALPHA_OPAQUE },
-	{ 255, 255,   0, SDL_ALPHA_OPAQUE },
-	{ 255, 255, 255, SDL_ALPHA_OPAQUE },
-};
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
 
 void printDisplayInfo(int display_index) {
 	// print display name
@@ -52,11 +47,226 @@ void printAllDisplaysInfo() {
 	}
 }
 
+// Camera and culling
+//
+// Maps are laid out in world units, the camera maps them to window pixels.
+// Lines and rotors never move, so they are sorted once per map into a grid of
+// cells. Drawing only looks at the cells the window covers and a map many
+// screens wide costs what is on screen. Balls move every tick and are only
+// checked against the window.
+
+#define MIN_ZOOM 0.05f
+#define MAX_ZOOM 8.0f
+// world units, a few rotors per cell
+#define RENDER_CELL_SIZE 256.0f
+// keeps the grid small for maps with far out coordinates
+#define RENDER_MAX_CELLS 1024
+
+struct RenderIndex {
+	uint32 map_id;
+	int line_count;
+	int rotor_count;
+	float min_x;
+	float min_y;
+	float cell_width;
+	float cell_height;
+	int columns;
+	int rows;
+	// the items of cell c are items[cell_start[c]] up to items[cell_start[c + 1]], rotors as ~index
+	vector<int> cell_start;
+	vector<int> items;
+	// lines and rotors in several cells are only taken once per query
+	vector<uint32> line_marks;
+	vector<uint32> rotor_marks;
+	uint32 mark;
+	// found by the last query, in index order
+	vector<int> lines;
+	vector<int> rotors;
+};
+
+void worldToScreen(const GameData *gd, float x, float y, float *screen_x, float *screen_y) {
+	*screen_x = (x - gd->camera_x) * gd->zoom;
+	*screen_y = (y - gd->camera_y) * gd->zoom;
+}
+
+void screenToWorld(const GameData *gd, float screen_x, float screen_y, float *x, float *y) {
+	*x = gd->camera_x + screen_x / gd->zoom;
+	*y = gd->camera_y + screen_y / gd->zoom;
+}
+
+void resetCamera(GameData *gd) {
+	gd->camera_x = 0;
+	gd->camera_y = 0;
+	gd->zoom = 1.0f;
+	gd->full_redraw = true;
+}
+
+// by window pixels, the world moves along with the mouse
+void panCamera(GameData *gd, float dx, float dy) {
+	gd->camera_x -= dx / gd->zoom;
+	gd->camera_y -= dy / gd->zoom;
+	gd->full_redraw = true;
+}
+
+// the world point under the given window pixel stays where it is
+void zoomCamera(GameData *gd, float factor, float screen_x, float screen_y) {
+	float x, y;
+	screenToWorld(gd, screen_x, screen_y, &x, &y);
+	gd->zoom = SDL_max(MIN_ZOOM, SDL_min(MAX_ZOOM, gd->zoom * factor));
+	gd->camera_x = x - screen_x / gd->zoom;
+	gd->camera_y = y - screen_y / gd->zoom;
+	gd->full_redraw = true;
+}
+
+static void getLineBounds(const Line *line, float *x1, float *y1, float *x2, float *y2) {
+	*x1 = SDL_min(line->x1, line->x2);
+	*y1 = SDL_min(line->y1, line->y2);
+	*x2 = SDL_max(line->x1, line->x2);
+	*y2 = SDL_max(line->y1, line->y2);
+}
+
+static void getRotorBounds(const Rotor *rotor, float *x1, float *y1, float *x2, float *y2) {
+	*x1 = rotor->x - 30;
+	*y1 = rotor->y - 30;
+	*x2 = rotor->x + 30;
+	*y2 = rotor->y + 30;
+}
+
+static void getCellRange(const RenderIndex *index, float x1, float y1, float x2, float y2, int *column1, int *row1, int *column2, int *row2) {
+	*column1 = (int)SDL_max(0.0f, SDL_min((float)(index->columns - 1), floorf((x1 - index->min_x) / index->cell_width)));
+	*row1 = (int)SDL_max(0.0f, SDL_min((float)(index->rows - 1), floorf((y1 - index->min_y) / index->cell_height)));
+	*column2 = (int)SDL_max(0.0f, SDL_min((float)(index->columns - 1), floorf((x2 - index->min_x) / index->cell_width)));
+	*row2 = (int)SDL_max(0.0f, SDL_min((float)(index->rows - 1), floorf((y2 - index->min_y) / index->cell_height)));
+}
+
+// counts items per cell on the first pass and fills them in on the second
+static void sortIntoCells(GameData *gd, RenderIndex *index, bool fill, vector<int> *next) {
+	for (int i = 0; i < gd->line_count + gd->rotor_count; ++i) {
+		float x1, y1, x2, y2;
+		if (i < gd->line_count) {
+			getLineBounds(&gd->lines[i], &x1, &y1, &x2, &y2);
+		} else {
+			getRotorBounds(&gd->rotors[i - gd->line_count], &x1, &y1, &x2, &y2);
+		}
+		int column1, row1, column2, row2;
+		getCellRange(index, x1, y1, x2, y2, &column1, &row1, &column2, &row2);
+		for (int row = row1; row <= row2; ++row) {
+			for (int column = column1; column <= column2; ++column) {
+				int cell = row * index->columns + column;
+				if (fill) {
+					index->items[(*next)[cell]++] = i < gd->line_count ? i : ~(i - gd->line_count);
+				} else {
+					++index->cell_start[cell + 1];
+				}
+			}
+		}
+	}
+}
+
+static void buildRenderIndex(GameData *gd, RenderIndex *index) {
+	float min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+	for (int i = 0; i < gd->line_count + gd->rotor_count; ++i) {
+		float x1, y1, x2, y2;
+		if (i < gd->line_count) {
+			getLineBounds(&gd->lines[i], &x1, &y1, &x2, &y2);
+		} else {
+			getRotorBounds(&gd->rotors[i - gd->line_count], &x1, &y1, &x2, &y2);
+		}
+		if (i == 0) {
+			min_x = x1, min_y = y1, max_x = x2, max_y = y2;
+		}
+		min_x = SDL_min(min_x, x1);
+		min_y = SDL_min(min_y, y1);
+		max_x = SDL_max(max_x, x2);
+		max_y = SDL_max(max_y, y2);
+	}
+
+	index->map_id = gd->map_id;
+	index->line_count = gd->line_count;
+	index->rotor_count = gd->rotor_count;
+	index->min_x = min_x;
+	index->min_y = min_y;
+	index->columns = SDL_min((int)((max_x - min_x) / RENDER_CELL_SIZE) + 1, RENDER_MAX_CELLS);
+	index->rows = SDL_min((int)((max_y - min_y) / RENDER_CELL_SIZE) + 1, RENDER_MAX_CELLS);
+	index->cell_width = SDL_max((max_x - min_x) / index->columns, RENDER_CELL_SIZE);
+	index->cell_height = SDL_max((max_y - min_y) / index->rows, RENDER_CELL_SIZE);
+
+	int cell_count = index->columns * index->rows;
+	index->cell_start.assign(cell_count + 1, 0);
+	sortIntoCells(gd, index, false, NULL);
+	for (int i = 0; i < cell_count; ++i) {
+		index->cell_start[i + 1] += index->cell_start[i];
+	}
+	index->items.resize(index->cell_start[cell_count]);
+	vector<int> next(index->cell_start.begin(), index->cell_start.end() - 1);
+	sortIntoCells(gd, index, true, &next);
+
+	index->line_marks.assign(gd->line_count, 0);
+	index->rotor_marks.assign(gd->rotor_count, 0);
+	index->mark = 0;
+}
+
+// rebuilt whenever the map changed, resetGame builds a new one
+static RenderIndex *getRenderIndex(GameData *gd) {
+	if (gd->render_index == NULL) {
+		gd->render_index = new RenderIndex();
+		gd->render_index->map_id = 0;
+	}
+	RenderIndex *index = gd->render_index;
+	if (index->map_id != gd->map_id || index->line_count != gd->line_count || index->rotor_count != gd->rotor_count) {
+		buildRenderIndex(gd, index);
+	}
+	return index;
+}
+
+// finds the lines and rotors that may touch the world rectangle
+static void queryRenderIndex(GameData *gd, float x1, float y1, float x2, float y2) {
+	RenderIndex *index = getRenderIndex(gd);
+	index->lines.clear();
+	index->rotors.clear();
+	if (++index->mark == 0) {
+		fill(index->line_marks.begin(), index->line_marks.end(), 0);
+		fill(index->rotor_marks.begin(), index->rotor_marks.end(), 0);
+		index->mark = 1;
+	}
+	int column1, row1, column2, row2;
+	getCellRange(index, x1, y1, x2, y2, &column1, &row1, &column2, &row2);
+	for (int row = row1; row <= row2; ++row) {
+		for (int column = column1; column <= column2; ++column) {
+			int cell = row * index->columns + column;
+			for (int k = index->cell_start[cell]; k < index->cell_start[cell + 1]; ++k) {
+				int item = index->items[k];
+				if (item >= 0 && index->line_marks[item] != index->mark) {
+					index->line_marks[item] = index->mark;
+					index->lines.push_back(item);
+				} else if (item < 0 && index->rotor_marks[~item] != index->mark) {
+					index->rotor_marks[~item] = index->mark;
+					index->rotors.push_back(~item);
+				}
+			}
+		}
+	}
+	// drawn in the same order as without the index
+	sort(index->lines.begin(), index->lines.end());
+	sort(index->rotors.begin(), index->rotors.end());
+}
+
+int findRotorAt(GameData *gd, float x, float y) {
+	queryRenderIndex(gd, x, y, x, y);
+	const vector<int> &rotors = gd->render_index->rotors;
+	for (size_t k = 0; k < rotors.size(); ++k) {
+		const Rotor *rotor = &gd->rotors[rotors[k]];
+		if (-30 <= x - rotor->x && x - rotor->x <= 30 && -30 <= y - rotor->y && y - rotor->y <= 30)
+			return rotors[k];
+	}
+	return -1;
+}
+
 int startGraphics(GameData *gd) {
 	gd->win = NULL;
 	gd->renderer = NULL;
-
-	printAllDisplaysInfo();
+	gd->interpolation = 1.0f;
+	resetCamera(gd);
 
 	SDL_Rect display_bounds;
 	if (SDL_GetDisplayBounds(0, &display_bounds) < 0) {
@@ -64,18 +274,43 @@ int startGraphics(GameData *gd) {
 		return 1;
 	}
 
-	int width = 800, height = 600;
+	if (gd->view_width <= 0 || gd->view_height <= 0) {
+		gd->view_width = 800;
+		gd->view_height = 600;
+	}
+	int width = gd->view_width, height = gd->view_height;
 	int x = display_bounds.x + (display_bounds.w - width) / 2;
 	int y = display_bounds.y + (display_bounds.h - height) / 2;
 
-	SDL_Window *win = SDL_CreateWindow("Logical", x, y, width, height, 0);
+	// the window surface of the dirty rectangle renderer does not survive resizing
+	Uint32 flags = gd->dirty_rects ? 0 : SDL_WINDOW_RESIZABLE;
+	SDL_Window *win = SDL_CreateWindow("Logical", x, y, width, height, flags);
 	if (win == NULL) {
 		SDL_Log("SDL_CreateWindow failed: %s", SDL_GetError());
 		return 2;
 	}
 	gd->win = win;
-
-	SDL_Renderer *renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+	SDL_Renderer *renderer;
+	if (gd->dirty_rects) {
+		// draw straight into the window surface, so only damaged parts need to be copied to the screen
+		SDL_Surface *surface = SDL_GetWindowSurface(win);
+		if (surface == NULL) {
+			SDL_Log("SDL_GetWindowSurface failed: %s", SDL_GetError());
+			return 3;
+		}
+		renderer = SDL_CreateSoftwareRenderer(surface);
+		gd->full_redraw = true;
+		gd->drawn_line_count = -1;
+		gd->drawn_rotor_count = -1;
+		for (int i = 0; i < NBALLS; ++i) {
+			gd->drawn_balls[i].w = 0;
+		}
+		for (int i = 0; i < NROTORS; ++i) {
+			gd->drawn_rotors_destroyed[i] = false;
+		}
+	} else {
+		renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+	}
 	if (renderer == NULL) {
 		SDL_Log("SDL_CreateRenderer failed: %s", SDL_GetError());
 		return 3;
@@ -95,6 +330,9 @@ void stopGraphics(GameData *gd) {
 		SDL_DestroyWindow(gd->win);
 		gd->win = NULL;
 	}
+
+	delete gd->render_index;
+	gd->render_index = NULL;
 }
 
 void clearScreen(GameData *gd) {
@@ -102,23 +340,29 @@ void clearScreen(GameData *gd) {
     SDL_RenderClear(gd->renderer);
 }
 
+// a square of the given half size in world units around a world point, in window pixels
+static SDL_Rect getSquareRect(GameData *gd, float x, float y, float half_size) {
+	float screen_x, screen_y;
+	worldToScreen(gd, x - half_size, y - half_size, &screen_x, &screen_y);
+	int size = SDL_max((int)(2 * half_size * gd->zoom), 1);
+	SDL_Rect rect = {(int)floorf(screen_x), (int)floorf(screen_y), size, size};
+	return rect;
+}
+
 void renderLine(GameData *gd, int i) {
+	float x1, y1, x2, y2;
+	worldToScreen(gd, gd->lines[i].x1, gd->lines[i].y1, &x1, &y1);
+	worldToScreen(gd, gd->lines[i].x2, gd->lines[i].y2, &x2, &y2);
 	SDL_SetRenderDrawColor(gd->renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
-	SDL_RenderDrawLine(gd->renderer, (int)gd->lines[i].x1, (int)gd->lines[i].y1, (int)gd->lines[i].x2, (int)gd->lines[i].y2);
+	SDL_RenderDrawLine(gd->renderer, (int)x1, (int)y1, (int)x2, (int)y2);
 }
 
-void renderLines(GameData *gd) {
-	for (int i = 0; i < gd->line_count; ++i) {
-		renderLine(gd, i);
-	}
+SDL_Rect getRotorRect(GameData *gd, int i) {
+	return getSquareRect(gd, gd->rotors[i].x, gd->rotors[i].y, 30);
 }
 
 void renderRotor(GameData *gd, int i) {
-	SDL_Rect rect;
-	rect.x = (int)gd->rotors[i].x - 30;
-	rect.y = (int)gd->rotors[i].y - 30;
-	rect.w = 60;
-	rect.h = 60;
+	SDL_Rect rect = getRotorRect(gd, i);
 	if (gd->rotors[i].destroyed) {
 		SDL_SetRenderDrawColor(gd->renderer, 0x66, 0x66, 0x66, SDL_ALPHA_OPAQUE);
 	} else {
@@ -129,39 +373,33 @@ void renderRotor(GameData *gd, int i) {
 	SDL_RenderDrawRect(gd->renderer, &rect);
 }
 
-void renderRotors(GameData *gd) {
-	for (int i = 0; i < gd->rotor_count; ++i) {
-		renderRotor(gd, i);
+SDL_Rect getBallRect(GameData *gd, int i) {
+	const Ball *ball = &gd->balls[i];
+	float x, y;
+	getBallPosition(gd, i, &x, &y);
+	// balls that were not there at the previous tick are drawn where they are
+	if (ball->has_prev && gd->interpolation < 1.0f) {
+		x = ball->prev_x + (x - ball->prev_x) * gd->interpolation;
+		y = ball->prev_y + (y - ball->prev_y) * gd->interpolation;
 	}
+	return getSquareRect(gd, x, y, 10);
 }
 
 void renderBall(GameData *gd, int i) {
 	int type = gd->balls[i].type;
 	if (type == BALL_TYPE_NONE)
 		return;
-	float x = gd->balls[i].x;
-	float y = gd->balls[i].y;
 	Uint8 r = BALL_COLORS[type + 1][0];
 	Uint8 g = BALL_COLORS[type + 1][1];
 	Uint8 b = BALL_COLORS[type + 1][2];
 	Uint8 a = BALL_COLORS[type + 1][3];
 	SDL_SetRenderDrawColor(gd->renderer, r, g, b, a);
-	SDL_Rect rect = {(int)(x - 10), (int)(y - 10), 20, 20};
+	SDL_Rect rect = getBallRect(gd, i);
 	SDL_RenderFillRect(gd->renderer, &rect);
 }
 
-void renderBalls(GameData *gd) {
-	for (int i = 0; i < NBALLS; ++i) {
-		renderBall(gd, i);
-	}
-}
-
 void renderRotorCenter(GameData *gd, int i) {
-	SDL_Rect rect;
-	rect.x = (int)gd->rotors[i].x - 10;
-	rect.y = (int)gd->rotors[i].y - 10;
-	rect.w = 20;
-	rect.h = 20;
+	SDL_Rect rect = getSquareRect(gd, gd->rotors[i].x, gd->rotors[i].y, 10);
 	if (gd->rotors[i].destroyed) {
 		SDL_SetRenderDrawColor(gd->renderer, 0x66, 0x66, 0x66, SDL_ALPHA_OPAQUE);
 	} else {
@@ -172,17 +410,136 @@ void renderRotorCenter(GameData *gd, int i) {
 	SDL_RenderDrawRect(gd->renderer, &rect);
 }
 
-void renderRotorCenters(GameData *gd) {
-	for (int i = 0; i < gd->rotor_count; ++i) {
-		renderRotorCenter(gd, i);
+// draws whatever touches the region of the window, in window pixels
+void renderVisible(GameData *gd, const SDL_Rect *region) {
+	float x1, y1, x2, y2;
+	screenToWorld(gd, (float)region->x, (float)region->y, &x1, &y1);
+	screenToWorld(gd, (float)(region->x + region->w), (float)(region->y + region->h), &x2, &y2);
+	queryRenderIndex(gd, x1, y1, x2, y2);
+	const RenderIndex *index = gd->render_index;
+
+	for (size_t k = 0; k < index->lines.size(); ++k) {
+		renderLine(gd, index->lines[k]);
+	}
+	for (size_t k = 0; k < index->rotors.size(); ++k) {
+		renderRotor(gd, index->rotors[k]);
+	}
+	for (int i = 0; i < gd->ball_end; ++i) {
+		if (gd->balls[i].type == BALL_TYPE_NONE)
+			continue;
+		SDL_Rect rect = getBallRect(gd, i);
+		if (SDL_HasIntersection(&rect, region))
+			renderBall(gd, i);
+	}
+	for (size_t k = 0; k < index->rotors.size(); ++k) {
+		renderRotorCenter(gd, index->rotors[k]);
 	}
 }
 
-void renderEverything(GameData *gd) {
+void renderScene(GameData *gd) {
+	SDL_GetWindowSize(gd->win, &gd->view_width, &gd->view_height);
+	SDL_Rect view = {0, 0, gd->view_width, gd->view_height};
 	clearScreen(gd);
-	renderLines(gd);
-	renderRotors(gd);
-	renderBalls(gd);
-	renderRotorCenters(gd);
+	renderVisible(gd, &view);
+}
+
+void renderEverything(GameData *gd) {
+	if (gd->dirty_rects) {
+		renderDirtyRects(gd);
+		return;
+	}
+	renderScene(gd);
     SDL_RenderPresent(gd->renderer);
 }
+
+// dirty rectangles
+
+#define MAX_DIRTY_RECTS 32
+
+void addDirtyRect(SDL_Rect *rects, int *rect_count, SDL_Rect rect) {
+	// merge with an overlapping rectangle if there is one
+	for (int i = 0; i < *rect_count; ++i) {
+		if (SDL_HasIntersection(&rects[i], &rect)) {
+			SDL_UnionRect(&rects[i], &rect, &rects[i]);
+			return;
+		}
+	}
+	if (*rect_count < MAX_DIRTY_RECTS) {
+		rects[(*rect_count)++] = rect;
+	} else {
+		SDL_UnionRect(&rects[0], &rect, &rects[0]);
+	}
+}
+
+// changes outside the window need no drawing
+static void addVisibleRect(SDL_Rect *rects, int *rect_count, SDL_Rect rect, const SDL_Rect *view) {
+	if (SDL_HasIntersection(&rect, view)) {
+		addDirtyRect(rects, rect_count, rect);
+	}
+}
+
+void renderRegion(GameData *gd, const SDL_Rect *region) {
+	SDL_RenderSetClipRect(gd->renderer, region);
+	SDL_SetRenderDrawColor(gd->renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+	SDL_RenderFillRect(gd->renderer, region);
+	renderVisible(gd, region);
+	SDL_RenderSetClipRect(gd->renderer, NULL);
+}
+
+// Redraws only what changed since the last frame: balls that moved, appeared
+// or vanished (which covers turned rotors) and rotors that got destroyed.
+void renderDirtyRects(GameData *gd) {
+	SDL_Rect rects[MAX_DIRTY_RECTS];
+	int rect_count = 0;
+	SDL_GetWindowSize(gd->win, &gd->view_width, &gd->view_height);
+	SDL_Rect view = {0, 0, gd->view_width, gd->view_height};
+
+	if (gd->line_count != gd->drawn_line_count || gd->rotor_count != gd->drawn_rotor_count) {
+		gd->full_redraw = true;
+	}
+
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		if (gd->rotors[i].destroyed != gd->drawn_rotors_destroyed[i]) {
+			addVisibleRect(rects, &rect_count, getRotorRect(gd, i), &view);
+			gd->drawn_rotors_destroyed[i] = gd->rotors[i].destroyed;
+		}
+	}
+
+	for (int i = 0; i < NBALLS; ++i) {
+		SDL_Rect *drawn = &gd->drawn_balls[i];
+		if (gd->balls[i].type == BALL_TYPE_NONE) {
+			if (drawn->w > 0) {
+				addVisibleRect(rects, &rect_count, *drawn, &view);
+				drawn->w = 0;
+			}
+			continue;
+		}
+		SDL_Rect rect = getBallRect(gd, i);
+		if (drawn->w == 0 || drawn->x != rect.x || drawn->y != rect.y) {
+			if (drawn->w > 0) {
+				addVisibleRect(rects, &rect_count, *drawn, &view);
+			}
+			addVisibleRect(rects, &rect_count, rect, &view);
+			*drawn = rect;
+		}
+	}
+
+	if (gd->full_redraw) {
+		SDL_GetWindowSize(gd->win, &rects[0].w, &rects[0].h);
+		rects[0].x = 0;
+		rects[0].y = 0;
+		rect_count = 1;
+		gd->full_redraw = false;
+		gd->drawn_line_count = gd->line_count;
+		gd->drawn_rotor_count = gd->rotor_count;
+	}
+
+	if (rect_count == 0)
+		return;
+
+	for (int i = 0; i < rect_count; ++i) {
+		renderRegion(gd, &rects[i]);
+	}
+	SDL_RenderPresent(gd->renderer);
+	SDL_UpdateWindowSurfaceRects(gd->win, rects, rect_count);
+}
@@ -0,0 +1,181 @@
+#include "logical.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Every line keeps the balls on it in a queue, in the order they got onto it.
+// All balls on a line move at the same speed, so that is also their order
+// along the line and the first ball is the one that reaches the end next. The
+// queue is linked through Ball::line_next, so a line holds any number of
+// balls without a capacity of its own.
+//
+// With GameData::line_spacing the queues also do the flow control: balls on a
+// line keep LINE_SPACING apart, the first ball waits at the end while
+// whatever comes next has no room for it, and the balls behind it queue up.
+// Nothing gets onto a line before its last ball is LINE_SPACING away from the
+// start. Only the first ball of a line is ever checked against the end.
+
+struct QueuedBall {
+	int line_index;
+	double distance;
+	int ball_index;
+};
+
+static bool isFurtherAlong(const QueuedBall &a, const QueuedBall &b) {
+	if (a.line_index != b.line_index)
+		return a.line_index < b.line_index;
+	if (a.distance != b.distance)
+		return a.distance > b.distance;
+	return a.ball_index < b.ball_index;
+}
+
+// how far a ball got along its line, the projection of its position onto the line
+static float lineDistance(const GameData *gd, int ball_index) {
+	const Ball *ball = &gd->balls[ball_index];
+	const Line *line = &gd->lines[ball->connector.target];
+	float line_x = line->x2 - line->x1;
+	float line_y = line->y2 - line->y1;
+	float length = sqrt(line_x * line_x + line_y * line_y);
+	if (length == 0)
+		return 0;
+	return ((ball->x - line->x1) * line_x + (ball->y - line->y1) * line_y) / length;
+}
+
+// after the map got built or a snapshot unpacked, the balls on a line are sorted by how far along they are
+void rebuildLineQueues(GameData *gd) {
+	for (int i = 0; i < gd->line_count; ++i) {
+		gd->line_queues[i].first = -1;
+		gd->line_queues[i].last = -1;
+		gd->line_queues[i].first_waiting = false;
+	}
+	vector<QueuedBall> queued;
+	for (int i = 0; i < gd->ball_end; ++i) {
+		if (gd->balls[i].type == BALL_TYPE_NONE || gd->balls[i].connector.type != CONNECTOR_LINE)
+			continue;
+		QueuedBall ball;
+		ball.line_index = gd->balls[i].connector.target;
+		ball.distance = gd->fixed_point ? gd->balls[i].line_progress : lineDistance(gd, i);
+		ball.ball_index = i;
+		queued.push_back(ball);
+	}
+	sort(queued.begin(), queued.end(), isFurtherAlong);
+	for (size_t i = 0; i < queued.size(); ++i) {
+		enqueueBallOnLine(gd, queued[i].ball_index, queued[i].line_index);
+	}
+}
+
+void enqueueBallOnLine(GameData *gd, int ball_index, int line_index) {
+	LineQueue *queue = &gd->line_queues[line_index];
+	gd->balls[ball_index].line_next = -1;
+	if (queue->last >= 0) {
+		gd->balls[queue->last].line_next = ball_index;
+	} else {
+		queue->first = ball_index;
+	}
+	queue->last = ball_index;
+}
+
+// Usually the first ball. Without spacing, balls that pass the end during the
+// same tick leave in the order of their index, which is all near the front.
+void dequeueBallFromLine(GameData *gd, int ball_index) {
+	LineQueue *queue = &gd->line_queues[gd->balls[ball_index].connector.target];
+	int previous = -1;
+	int current = queue->first;
+	while (current >= 0 && current != ball_index) {
+		previous = current;
+		current = gd->balls[current].line_next;
+	}
+	if (current < 0)
+		return;
+	int next = gd->balls[ball_index].line_next;
+	if (previous < 0) {
+		queue->first = next;
+		queue->first_waiting = false;
+	} else {
+		gd->balls[previous].line_next = next;
+	}
+	if (queue->last == ball_index) {
+		queue->last = previous;
+	}
+	gd->balls[ball_index].line_next = -1;
+}
+
+// whether a ball may go there now, only lines without room turn anybody away
+bool canEnterConnector(const GameData *gd, const Connector *connector) {
+	if (!gd->line_spacing || connector->type != CONNECTOR_LINE)
+		return true;
+	int last = gd->line_queues[connector->target].last;
+	if (last < 0)
+		return true;
+	if (gd->fixed_point)
+		return gd->balls[last].line_progress >= ((int32)LINE_SPACING << FIXED_SHIFT);
+	return lineDistance(gd, last) >= LINE_SPACING;
+}
+
+static void moveLineQueueFixed(GameData *gd, int line_index, Time t) {
+	LineQueue *queue = &gd->line_queues[line_index];
+	const Line *line = &gd->lines[line_index];
+	int64 step = (int64)LINE_VELOCITY * t * (1 << FIXED_SHIFT) / seconds(1);
+	int64 limit = line->fixed_length;
+	for (int ball_index = queue->first; ball_index >= 0; ball_index = gd->balls[ball_index].line_next) {
+		Ball *ball = &gd->balls[ball_index];
+		int64 progress = SDL_min(ball->line_progress + step, limit);
+		// a ball never moves back, not even if the one in front got there too close
+		progress = SDL_max(progress, (int64)ball->line_progress);
+		if (ball_index == queue->first && progress == line->fixed_length) {
+			queue->first_waiting = true;
+		}
+		ball->line_progress = (int32)progress;
+		ball->fixed_x = line->fixed_x1 + (int32)((line->fixed_dir_x * progress) >> FIXED_DIR_SHIFT);
+		ball->fixed_y = line->fixed_y1 + (int32)((line->fixed_dir_y * progress) >> FIXED_DIR_SHIFT);
+		ball->x = fromFixed(ball->fixed_x);
+		ball->y = fromFixed(ball->fixed_y);
+		limit = progress - ((int64)LINE_SPACING << FIXED_SHIFT);
+	}
+}
+
+static void moveLineQueue(GameData *gd, int line_index, Time t) {
+	LineQueue *queue = &gd->line_queues[line_index];
+	const Line *line = &gd->lines[line_index];
+	// one square root per line instead of one per ball
+	float line_x = line->x2 - line->x1;
+	float line_y = line->y2 - line->y1;
+	float length = sqrt(line_x * line_x + line_y * line_y);
+	float dir_x = length > 0 ? line_x / length : 0;
+	float dir_y = length > 0 ? line_y / length : 0;
+	float step = LINE_VELOCITY * (t / (float)seconds(1));
+	float limit = length;
+	for (int ball_index = queue->first; ball_index >= 0; ball_index = gd->balls[ball_index].line_next) {
+		Ball *ball = &gd->balls[ball_index];
+		float distance = (ball->x - line->x1) * dir_x + (ball->y - line->y1) * dir_y;
+		float moved = SDL_min(distance + step, limit);
+		moved = SDL_max(moved, distance);
+		if (ball_index == queue->first && moved >= length) {
+			queue->first_waiting = true;
+			ball->x = line->x2;
+			ball->y = line->y2;
+		} else if (moved != distance) {
+			ball->x = line->x1 + dir_x * moved;
+			ball->y = line->y1 + dir_y * moved;
+		}
+		limit = moved - LINE_SPACING;
+	}
+}
+
+// With spacing, the first part of the tick: every line moves its balls from
+// the first one backwards, so each ball sees where the one in front of it is
+// now. Balls at the end are handed on afterwards by progressBall.
+void moveLineQueues(GameData *gd, Time t) {
+	for (int i = 0; i < gd->line_count; ++i) {
+		if (gd->line_queues[i].first < 0)
+			continue;
+		if (gd->fixed_point) {
+			moveLineQueueFixed(gd, i, t);
+		} else {
+			moveLineQueue(gd, i, t);
+		}
+	}
+}
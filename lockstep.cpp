@@ -0,0 +1,299 @@
+#include "logical.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Differential checker: every seed runs one game on the reference engine
+// (reference.cpp) and one on the engine under test, feeds both the same
+// random actions and compares their whole state after every tick. Seeds run
+// in parallel on the worker threads, in rounds so that a soak run can report
+// its progress.
+//
+// Every now and then the engine is also forked, the fork gets the same
+// actions and ticks, and a while later both have to pack to the same bytes.
+
+#define LOCKSTEP_ROUND_TICKS 10000
+#define LOCKSTEP_TICK_TIME (seconds(1) / 60)
+#define LOCKSTEP_FORK_EVERY 250
+#define LOCKSTEP_FORK_TICKS 100
+
+struct LockstepSeed {
+	uint32 seed;
+	GameData *reference;
+	GameData *engine;
+	// forked from the engine in tick fork_tick, -1 while not in use
+	GameData *fork;
+	int64 fork_tick;
+	// drives the actions, separate from the random numbers of the games
+	Random inputs;
+	int64 ticks_done;
+	bool diverged;
+	char report[256];
+};
+
+struct LockstepJob {
+	const LockstepParams *params;
+	vector<LockstepSeed> *seeds;
+	int64 round_end;
+	atomic<bool> diverged;
+};
+
+static bool sameFloat(float a, float b) {
+	// bit for bit, -0 and 0 count as different and so does every NaN
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// each returns true if the values differ and describes them in report
+static bool differsInt(char *report, int size, const char *field, int index, int64 reference, int64 engine) {
+	if (reference == engine)
+		return false;
+	if (index >= 0) {
+		SDL_snprintf(report, size, "%s of %d is %lld in the reference and %lld in the engine", field, index, (long long)reference, (long long)engine);
+	} else {
+		SDL_snprintf(report, size, "%s is %lld in the reference and %lld in the engine", field, (long long)reference, (long long)engine);
+	}
+	return true;
+}
+
+static bool differsFloat(char *report, int size, const char *field, int index, float reference, float engine) {
+	if (sameFloat(reference, engine))
+		return false;
+	SDL_snprintf(report, size, "%s of %d is %.9g in the reference and %.9g in the engine", field, index, reference, engine);
+	return true;
+}
+
+// the state that matters for the game, not what only drawing or the tick itself uses
+static bool findDifference(const GameData *reference, const GameData *engine, char *report, int size) {
+	if (memcmp(&reference->random, &engine->random, sizeof(Random)) != 0) {
+		SDL_snprintf(report, size, "the random number generators are in different states");
+		return true;
+	}
+	if (differsInt(report, size, "time", -1, reference->time, engine->time) ||
+		differsInt(report, size, "rotor_count", -1, reference->rotor_count, engine->rotor_count) ||
+		differsInt(report, size, "spawn_count", -1, reference->spawn_count, engine->spawn_count) ||
+		differsInt(report, size, "ball_type_count", -1, reference->ball_type_count, engine->ball_type_count))
+		return true;
+	for (int i = 0; i < reference->ball_type_count; ++i) {
+		if (differsInt(report, size, "ball_types", i, reference->ball_types[i], engine->ball_types[i]))
+			return true;
+	}
+
+	for (int i = 0; i < NBALLS; ++i) {
+		const Ball *a = &reference->balls[i];
+		const Ball *b = &engine->balls[i];
+		if (differsInt(report, size, "type of ball", i, a->type, b->type))
+			return true;
+		// whatever a removed ball leaves behind does not matter
+		if (a->type == BALL_TYPE_NONE)
+			continue;
+		int connector_type = a->connector.type;
+		if (differsInt(report, size, "connector type of ball", i, connector_type, b->connector.type) ||
+			differsInt(report, size, "connector target of ball", i, a->connector.target, b->connector.target) ||
+			(connector_type == CONNECTOR_ROTOR && differsInt(report, size, "rotor position of ball", i, a->connector.rotor.position, b->connector.rotor.position)) ||
+			differsInt(report, size, "released_counter of ball", i, a->released_counter, b->released_counter) ||
+			differsInt(report, size, "spawn_index of ball", i, a->spawn_index, b->spawn_index) ||
+			differsInt(report, size, "created of ball", i, a->created, b->created))
+			return true;
+		// balls in spawns and inserters have no position yet
+		float a_x, a_y, b_x, b_y;
+		getBallPosition(reference, i, &a_x, &a_y);
+		getBallPosition(engine, i, &b_x, &b_y);
+		if (connector_type != CONNECTOR_SPAWN && connector_type != CONNECTOR_INSERTER &&
+			(differsFloat(report, size, "x of ball", i, a_x, b_x) || differsFloat(report, size, "y of ball", i, a_y, b_y)))
+			return true;
+		if (connector_type == CONNECTOR_FREE &&
+			(differsFloat(report, size, "vx of ball", i, a->vx, b->vx) || differsFloat(report, size, "vy of ball", i, a->vy, b->vy)))
+			return true;
+		if (!reference->fixed_point)
+			continue;
+		if (connector_type == CONNECTOR_LINE && differsInt(report, size, "line_progress of ball", i, a->line_progress, b->line_progress))
+			return true;
+		if ((connector_type == CONNECTOR_LINE || connector_type == CONNECTOR_FREE) &&
+			(differsInt(report, size, "fixed_x of ball", i, a->fixed_x, b->fixed_x) || differsInt(report, size, "fixed_y of ball", i, a->fixed_y, b->fixed_y)))
+			return true;
+	}
+
+	for (int i = 0; i < reference->rotor_count; ++i) {
+		const Rotor *a = &reference->rotors[i];
+		const Rotor *b = &engine->rotors[i];
+		if (differsInt(report, size, "destroyed of rotor", i, a->destroyed, b->destroyed) ||
+			differsInt(report, size, "right ball of rotor", i, a->balls[ROTOR_POSITION_RIGHT], b->balls[ROTOR_POSITION_RIGHT]) ||
+			differsInt(report, size, "top ball of rotor", i, a->balls[ROTOR_POSITION_TOP], b->balls[ROTOR_POSITION_TOP]) ||
+			differsInt(report, size, "left ball of rotor", i, a->balls[ROTOR_POSITION_LEFT], b->balls[ROTOR_POSITION_LEFT]) ||
+			differsInt(report, size, "bottom ball of rotor", i, a->balls[ROTOR_POSITION_BOTTOM], b->balls[ROTOR_POSITION_BOTTOM]))
+			return true;
+	}
+	return false;
+}
+
+static int countBalls(const GameData *gd) {
+	int count = 0;
+	for (int i = 0; i < NBALLS; ++i) {
+		count += gd->balls[i].type != BALL_TYPE_NONE;
+	}
+	return count;
+}
+
+// Mostly turns and releases, now and then a new ball or a reset, and some
+// actions that are out of range on purpose so both engines have to reject them.
+static void randomAction(LockstepSeed *seed, Action *action) {
+	Random *random = &seed->inputs;
+	const GameData *gd = seed->reference;
+	uint32 kind = random_get(random) % 1000;
+	action->target = (int32)(random_get(random) % (gd->rotor_count + 2)) - 1;
+	if (kind < 480) {
+		action->type = ACTION_TURN_ROTOR;
+		action->argument = random_get(random) % 3;
+	} else if (kind < 960) {
+		action->type = ACTION_RELEASE_BALL;
+		action->argument = random_get(random) % 5;
+	} else if (kind < 999 && countBalls(gd) < NBALLS / 2) {
+		// a full game would make addBall fail, which the engine does not survive yet
+		action->type = ACTION_SPAWN_BALL;
+		action->target = (int32)(random_get(random) % (gd->spawn_count + 1));
+		action->argument = random_get(random) % (BALL_TYPE_WHITE + 2);
+	} else if (kind == 999) {
+		action->type = ACTION_RESET;
+		action->argument = 0;
+	} else {
+		action->type = ACTION_TURN_ROTOR;
+		action->argument = ROTOR_CLOCKWISE;
+	}
+}
+
+static bool samePacked(const GameData *a, const GameData *b) {
+	vector<byte> packed_a(packedGameSize(a));
+	vector<byte> packed_b(packedGameSize(b));
+	return packGame(a, packed_a.data(), (int)packed_a.size()) >= 0 && packGame(b, packed_b.data(), (int)packed_b.size()) >= 0 && packed_a == packed_b;
+}
+
+static void runSeed(void *context, int seed_index) {
+	LockstepJob *job = (LockstepJob *)context;
+	LockstepSeed *seed = &(*job->seeds)[seed_index];
+	while (!seed->diverged && seed->ticks_done < job->round_end) {
+		if (job->diverged.load(memory_order_relaxed))
+			return;
+		if (seed->ticks_done % LOCKSTEP_FORK_EVERY == 0) {
+			forkGame(seed->fork, seed->engine);
+			seed->fork_tick = seed->ticks_done;
+		}
+		// about one tick in four gets up to three actions
+		int action_count = random_get(&seed->inputs) % 4 == 0 ? 1 + random_get(&seed->inputs) % 3 : 0;
+		for (int i = 0; i < action_count; ++i) {
+			Action action;
+			randomAction(seed, &action);
+			// the reference does not keep ball_end, a reset has to free every ball
+			seed->reference->ball_end = NBALLS;
+			applyActionReference(seed->reference, &action);
+			applyAction(seed->engine, &action);
+			if (seed->fork_tick >= 0) {
+				applyAction(seed->fork, &action);
+			}
+		}
+		progressLogicReference(seed->reference, LOCKSTEP_TICK_TIME);
+		job->params->tick(seed->engine, LOCKSTEP_TICK_TIME);
+		if (seed->fork_tick >= 0) {
+			job->params->tick(seed->fork, LOCKSTEP_TICK_TIME);
+		}
+		++seed->ticks_done;
+		if (findDifference(seed->reference, seed->engine, seed->report, sizeof(seed->report))) {
+			seed->diverged = true;
+			job->diverged.store(true, memory_order_relaxed);
+		} else if (seed->fork_tick >= 0 && seed->ticks_done - seed->fork_tick == LOCKSTEP_FORK_TICKS) {
+			if (!samePacked(seed->engine, seed->fork)) {
+				SDL_snprintf(seed->report, sizeof(seed->report), "the fork of tick %lld packs differently", (long long)seed->fork_tick);
+				seed->diverged = true;
+				job->diverged.store(true, memory_order_relaxed);
+			}
+			seed->fork_tick = -1;
+		}
+	}
+}
+
+static GameData *startLockstepGame(const LockstepParams *params, uint32 seed) {
+	GameData *gd = new GameData();
+	gd->fixed_point = params->fixed_point;
+	gd->map_params = params->map_params;
+	if (params->map_path != NULL) {
+		SDL_strlcpy(gd->map_path, params->map_path, sizeof(gd->map_path));
+	}
+	if (newGame(gd, params->map_number, seed) != 0) {
+		delete gd;
+		return NULL;
+	}
+	return gd;
+}
+
+int runLockstep(const LockstepParams *params) {
+	vector<LockstepSeed> seeds(params->seed_count);
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+	for (int i = 0; i < params->seed_count; ++i) {
+		LockstepSeed *seed = &seeds[i];
+		seed->seed = params->first_seed + i;
+		seed->reference = startLockstepGame(params, seed->seed);
+		seed->engine = startLockstepGame(params, seed->seed);
+		seed->fork = new GameData();
+		seed->fork_tick = -1;
+		if (seed->reference == NULL || seed->engine == NULL) {
+			SDL_LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
+			SDL_Log("Lockstep: building map %d failed", params->map_number);
+			for (int j = 0; j <= i; ++j) {
+				delete seeds[j].reference;
+				delete seeds[j].engine;
+				delete seeds[j].fork;
+			}
+			return 1;
+		}
+		random_seed(&seed->inputs, seed->seed ^ 0x9E3779B9);
+		seed->ticks_done = 0;
+		seed->diverged = false;
+		seed->report[0] = 0;
+	}
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
+	SDL_Log("Lockstep: %d seeds from %u, %lld ticks each", params->seed_count, params->first_seed, (long long)params->tick_count);
+
+	LockstepJob job;
+	job.params = params;
+	job.seeds = &seeds;
+	job.round_end = 0;
+	job.diverged = false;
+	Time start = getCurrentTime();
+	while (job.round_end < params->tick_count && !job.diverged) {
+		job.round_end = SDL_min(job.round_end + LOCKSTEP_ROUND_TICKS, params->tick_count);
+		SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+		if (params->tick_uses_workers) {
+			// the engine needs the workers for itself, so one seed after another
+			for (int i = 0; i < params->seed_count; ++i) {
+				runSeed(&job, i);
+			}
+		} else {
+			runOnWorkers(params->seed_count, runSeed, &job);
+		}
+		SDL_LogSetAllPriority(SDL_LOG_PRIORITY_INFO);
+
+		int64 ticks = 0;
+		for (int i = 0; i < params->seed_count; ++i) {
+			ticks += seeds[i].ticks_done;
+		}
+		Time elapsed = SDL_max(getCurrentTime() - start, (Time)1);
+		SDL_Log("Lockstep: %lld ticks checked, %.0f ticks per second", (long long)ticks, ticks * 1e6 / elapsed);
+	}
+
+	int result = 0;
+	for (int i = 0; i < params->seed_count; ++i) {
+		if (seeds[i].diverged) {
+			SDL_Log("Lockstep: seed %u diverged in tick %lld, %s", seeds[i].seed, (long long)seeds[i].ticks_done, seeds[i].report);
+			result = 1;
+		}
+		delete seeds[i].reference;
+		delete seeds[i].engine;
+		delete seeds[i].fork;
+	}
+	if (result == 0) {
+		SDL_Log("Lockstep: no differences");
+	}
+	return result;
+}
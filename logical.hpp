@@ -8,6 +8,9 @@
 #include "std_types.hpp"
 #include "time.hpp"
 #include "random.hpp"
+#include "workers.hpp"
+#include "actions.hpp"
+#include "metrics.hpp"
 
 // constants
 
@@ -37,11 +40,57 @@
 #define ROTOR_CLOCKWISE     0
 #define ROTOR_ANTICLOCKWISE 1
 
+// game events: ball, target, argument
+#define EVENT_BALL_ON_LINE     1 // ball, line, -
+#define EVENT_BALL_IN_ROTOR    2 // ball, rotor, position
+#define EVENT_ROTOR_TURNED     3 // -1, rotor, direction
+#define EVENT_BALL_RELEASED    4 // ball, rotor, position
+#define EVENT_ROTOR_DESTROYED  5 // -1, rotor, ball type
+#define EVENT_BALL_DECAYED     6 // ball, -1, ball type
+
+// define LOGICAL_LARGE_MAPS for generated maps with thousands of rotors
+#if defined(LOGICAL_LARGE_MAPS)
+#define NBALLS 131072
+#define NROTORS 16384
+#define NLINES 65536
+#define NINSERTERS 8192
+#define NSPAWNS 256
+#define NEVENTS 65536
+#else
 #define NBALLS 500
 #define NROTORS 50
 #define NLINES 200
 #define NINSERTERS 50
 #define NSPAWNS 4
+#define NEVENTS 1024
+#endif
+
+// SSE2 is there on every x64 compiler and on x86 when asked for
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LOGICAL_SSE2
+#endif
+
+// fixed-point simulation: positions in 16.16, line directions in 2.30
+#define FIXED_SHIFT     16
+#define FIXED_DIR_SHIFT 30
+
+// closest two balls on one line may get, with GameData::line_spacing
+#define LINE_SPACING 20
+
+// live balls by what a tick has to do with them, see updateBallBucket
+#define BALL_BUCKET_LINE    0
+#define BALL_BUCKET_FREE    1
+// spawns, inserters and walls, what progressBall has to look at
+#define BALL_BUCKET_PENDING 2
+#define BALL_BUCKET_ROTOR   3
+#define BALL_BUCKETS        4
+// one bit per ball
+#define BALL_WORDS ((NBALLS + 63) / 64)
+
+#define MAP_COUNT 4
+// map numbers for maps that are not built in
+#define MAP_GENERATED 0
+#define MAP_FILE      -1
 
 // forward-declare types
 
@@ -79,6 +128,21 @@ struct Ball {
 	int type;
 	Time created;
 	Connector connector;
+
+	// the same in fixed-point, only moved when GameData::fixed_point is set
+	int32 fixed_x;
+	int32 fixed_y;
+	int32 fixed_vx;
+	int32 fixed_vy;
+	// distance travelled along the current line
+	int32 line_progress;
+	// the ball behind this one on the same line, -1 for the last one
+	int line_next;
+
+	// position before the last tick, for drawing in between ticks
+	float prev_x;
+	float prev_y;
+	bool has_prev;
 };
 
 struct Rotor {
@@ -86,6 +150,9 @@ struct Rotor {
 	float y;
 	Connector connectors[4];
 	int balls[4];
+	// the balls again as one byte per position, ball type + 1 or 0 if empty,
+	// so turning is a rotate and four of a kind a compare, see setRotorBall
+	uint32 slots;
 	bool destroyed;
 };
 
@@ -95,6 +162,22 @@ struct Line {
 	float x2;
 	float y2;
 	Connector connector;
+
+	// fixed-point geometry, see prepareFixedLines
+	int32 fixed_x1;
+	int32 fixed_y1;
+	int32 fixed_length;
+	int32 fixed_dir_x;
+	int32 fixed_dir_y;
+};
+
+// the balls on a line in the order they got onto it, see lines.cpp
+struct LineQueue {
+	// the ball closest to the end, -1 if the line is empty
+	int first;
+	int last;
+	// the first ball reached the end and waits for room behind it, only with spacing
+	bool first_waiting;
 };
 
 struct Inserter {
@@ -106,10 +189,58 @@ struct Spawn {
 	Connector connector;
 };
 
+// plain data, so consumers can copy and store them as they are
+struct GameEvent {
+	Time time;
+	int32 type;
+	int32 ball;
+	int32 target;
+	int32 argument;
+};
+
+// where a subscriber is in the event stream
+struct EventCursor {
+	uint32 position;
+	// events that were overwritten before they were read
+	uint32 missed;
+};
+
+// parameters for generateMap
+struct MapParams {
+	// grid of rotors
+	int columns;
+	int rows;
+	float spacing;
+	// chance that two neighbouring rotors are connected
+	float connectivity;
+	// every spawn feeds its own track of inserters along the top row
+	int spawn_count;
+	uint32 seed;
+};
+
+// parameters for runLockstep
+struct LockstepParams {
+	// the games, as for newGame
+	int map_number;
+	MapParams map_params;
+	const char *map_path;
+	bool fixed_point;
+	uint32 first_seed;
+	int seed_count;
+	// per seed
+	int64 tick_count;
+	// the engine under test
+	void (*tick)(GameData *, Time);
+	// set if tick uses the worker threads itself, the seeds then run one after another
+	bool tick_uses_workers;
+};
+
 struct GameData {
 	Ball balls[NBALLS];
 	Rotor rotors[NROTORS];
 	Line lines[NLINES];
+	// changes while playing, unlike the lines themselves
+	LineQueue line_queues[NLINES];
 	Inserter inserters[NINSERTERS];
 	Spawn spawns[NSPAWNS];
 
@@ -124,18 +255,126 @@ struct GameData {
 
 	int ball_type_index_next;
 
+	// index of the most recently allocated ball
+	int ball_last_added;
+	// no ball at or past this index is in use, lets forkGame skip the rest
+	int ball_end;
+	// bit n of a word in bucket b is set if ball 64 * word + n is in that bucket
+	uint64 ball_buckets[BALL_BUCKETS][BALL_WORDS];
+
 	Time time;
 
 	Random random;
 
+	// what resetGame starts over with
+	int map_number;
+	uint32 seed;
+	MapParams map_params;
+	char map_path[260];
+	// integer simulation, bit-identical across compilers, platforms and build flags
+	bool fixed_point;
+	// balls on a line keep LINE_SPACING apart and wait behind a blocked first ball
+	bool line_spacing;
+	// different for every map that gets built, resets of a built-in map from
+	// its image and forks of the same map share it
+	uint32 map_id;
+
 	SDL_Window *win;
 	SDL_Renderer *renderer;
+	// where to draw between the previous tick (0) and the last one (1)
+	float interpolation;
+	// the world point at the top left corner of the window and window pixels per world unit
+	float camera_x;
+	float camera_y;
+	float zoom;
+	// window size in pixels, 0 before startGraphics picks the default
+	int view_width;
+	int view_height;
+	// lines and rotors by where they are, for culling and hit-testing, see graphics.cpp
+	struct RenderIndex *render_index;
+
+	// the last NEVENTS events, only written while anybody is subscribed
+	GameEvent events[NEVENTS];
+	// total number of events written, the next one goes to event_head % NEVENTS
+	uint32 event_head;
+	int event_subscribers;
+
+	// dirty rectangle rendering, see renderDirtyRects
+	bool dirty_rects;
+	bool full_redraw;
+	int drawn_line_count;
+	int drawn_rotor_count;
+	SDL_Rect drawn_balls[NBALLS];
+	bool drawn_rotors_destroyed[NROTORS];
+};
+
+// compact snapshot of the mutable game state, see packed.cpp
+// layout: header, one destroyed bit per rotor (padded to 32 bits), ball records
+
+struct PackedGameHeader {
+	Time time;
+	Random random;
+	// total size of the snapshot in bytes, including this header
+	uint32 size;
+	uint32 ball_count;
+	uint16 rotor_count;
+	uint8 ball_type_count;
+	uint8 ball_type_index_next;
+	int8 ball_types[NUM_BALL_TYPES];
+	uint8 fixed_point;
+	uint8 line_spacing;
+	uint8 reserved[3];
+};
+
+struct PackedBall {
+	// NBALLS does not fit 16 bits with LOGICAL_LARGE_MAPS
+	uint32 index;
+	// type in bits 0-2, rotor position in bits 3-4, target + 1 in bits 5-31
+	uint32 connector;
+	// 0xFFFF if the ball did not come from a spawn
+	uint16 spawn_index;
+	int8 type;
+	// saturates at 255, the game only ever compares it against 0
+	uint8 released_counter;
+	// position in whole pixels for balls in rotors and at walls, 0 for all others
+	int16 x;
+	int16 y;
+	// followed by PackedBallMoving for balls on lines and PackedBallFree for free balls
+};
+
+struct PackedBallMoving {
+	float x;
+	float y;
+};
+
+struct PackedBallFree {
+	float x;
+	float y;
+	float vx;
+	float vy;
+	// time since the ball was created, saturates at INT32_MAX
+	int32 age;
+};
+
+// the same records in fixed-point games
+struct PackedBallMovingFixed {
+	int32 line_progress;
+	int32 reserved;
+};
+
+struct PackedBallFreeFixed {
+	int32 x;
+	int32 y;
+	int32 vx;
+	int32 vy;
+	int32 age;
 };
 
 // globals
 
 extern bool should_quit;
 extern const int ROTOR_POSITIONS[];
+extern const int LINE_VELOCITY;
 extern const Uint8 BALL_COLORS[][4];
 
 // functions
@@ -144,17 +383,89 @@ void buildMap1(GameData *);
 void buildMap2(GameData *);
 void buildMap3(GameData *);
 void buildMap4(GameData *);
+int buildMap(GameData *, int map_number);
+
+int placeRotor(GameData *, float x, float y);
+void placeLine(GameData *, const Connector *c1, const Connector *c2);
+void placeLineBetweenRotors(GameData *, int rotor_index_1, int rotor_index_2);
+
+void setDefaultMapParams(MapParams *);
+int generateMap(GameData *, const MapParams *);
+int saveMap(const GameData *, const char *path);
+int loadMap(GameData *, const char *path);
 
 void turnRotor(GameData *, int, int);
 void releaseBallFromRotor(GameData *, int, int);
+void applyAction(GameData *, const Action *);
 
-void resetGame(GameData *);
+int newGame(GameData *, int map_number, uint32 seed);
+int resetGame(GameData *);
+void forkGame(GameData *fork, const GameData *source);
 void progressLogic(GameData *, Time);
-void updateBallPosition(GameData *, int);
-
+void progressLogicParallel(GameData *, Time);
+void progressLogicReference(GameData *, Time);
+void applyActionReference(GameData *, const Action *);
+int runLockstep(const LockstepParams *);
+void progressBall(GameData *, int ball_index, Time);
+bool moveBallAlongLine(GameData *, int ball_index, Time);
+void finishBallOnLine(GameData *, int ball_index);
+bool moveFreeBall(GameData *, int ball_index);
+void updateBallBucket(GameData *, int ball_index);
+void rebuildBallBuckets(GameData *);
+int findMovingBall(const GameData *, int from, int end);
+void setRotorBall(GameData *, int rotor_index, int position, int ball_index);
+void getBallPosition(const GameData *, int ball_index, float *x, float *y);
+void countRotorMatches(const GameData *, uint8 *counts);
+void rememberBallPositions(GameData *);
+int32 toFixed(float);
+float fromFixed(int32);
+void rebuildLineQueues(GameData *);
+void enqueueBallOnLine(GameData *, int ball_index, int line_index);
+void dequeueBallFromLine(GameData *, int ball_index);
+bool canEnterConnector(const GameData *, const Connector *);
+void moveLineQueues(GameData *, Time);
+void prepareFixedLines(GameData *);
+void prepareLineBalls(GameData *);
+
+void printAllDisplaysInfo();
 int startGraphics(GameData *);
 void stopGraphics(GameData *);
+void renderScene(GameData *);
 void renderEverything(GameData *);
+void renderDirtyRects(GameData *);
+void worldToScreen(const GameData *, float x, float y, float *screen_x, float *screen_y);
+void screenToWorld(const GameData *, float screen_x, float screen_y, float *x, float *y);
+void resetCamera(GameData *);
+void panCamera(GameData *, float dx, float dy);
+void zoomCamera(GameData *, float factor, float screen_x, float screen_y);
+int findRotorAt(GameData *, float x, float y);
+
+int startDashboard(GameData *screen, int board_count);
+void stopDashboard();
+void tickDashboard(Time);
+void renderDashboard(GameData *screen);
+
+// width * height * 4 bytes of RGBA, the whole map fitted into the image
+void rasterizeGame(const GameData *, byte *pixels, int width, int height);
+void rasterizeGames(const GameData *games, int game_count, byte *pixels, int width, int height);
+
+#define SOUND_ROTOR_TURN      0
+#define SOUND_BALL_INSERTED   1
+#define SOUND_ROTOR_DESTROYED 2
+#define SOUND_COUNT           3
+
+int startAudio(GameData *, int buffer_frames);
+void stopAudio(GameData *);
+void playSound(int sound);
+void playEventSounds(GameData *);
+
+#define CAPTURE_RAW 0
+#define CAPTURE_PNG 1
+#define CAPTURE_Y4M 2
+
+int startCapture(GameData *, const char *path, int format, int fps, bool offline);
+void captureFrame(GameData *);
+void stopCapture(GameData *);
 
 void clearGame(GameData *);
 
@@ -172,6 +483,31 @@ int placeBallInSpawn(GameData *gd, int ball_type, int spawn_index);
 int placeRandomBallInSpawn(GameData *gd, int spawn_index);
 	
 void changeBallConnector(GameData *, int ball_index, const Connector *connector);
+
+// events, see events.cpp
+inline void emitEvent(GameData *gd, int type, int ball, int target, int argument) {
+	if (gd->event_subscribers == 0)
+		return;
+	GameEvent *event = &gd->events[gd->event_head++ % NEVENTS];
+	event->time = gd->time;
+	event->type = type;
+	event->ball = ball;
+	event->target = target;
+	event->argument = argument;
+}
+void subscribeEvents(GameData *, EventCursor *);
+void unsubscribeEvents(GameData *, EventCursor *);
+int readEvents(const GameData *, EventCursor *, GameEvent *events, int max_count);
 void copyConnector(const Connector *src, Connector *dst);
 
+int packedGameSize(const GameData *);
+int packGame(const GameData *, void *buffer, int capacity);
+int unpackGame(GameData *, const void *buffer, int size);
+uint64 hashPackedGame(const void *buffer, int size);
+int comparePackedGames(const void *buffer_1, int size_1, const void *buffer_2, int size_2);
+
+int startStateExport(const char *name);
+void stopStateExport();
+void exportState(const GameData *);
+
 #endif // LOGICAL_HPP_
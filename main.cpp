@@ -1,64 +1,165 @@
 #include "logical.hpp"
+#include "server.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace std;
 
 bool should_quit = false;
 
+// set when the game is played on a server instead of locally
+Client *remote = NULL;
+
+// number of games shown at once, 0 for the single game view
+int dashboard_boards = 0;
+
+// every player action goes through here, bots can push into it from any thread
+#define ACTION_QUEUE_SIZE 4096
+#define ACTION_BATCH_SIZE 64
+ActionQueue input_actions;
+
+// poll input once more right before drawing and apply it to what gets drawn
+bool late_latch = false;
+
+// When input events arrived, for the time until a present shows them. Actions
+// wait until they are applied, camera moves are shown by the next present.
+vector<Time> inputs_queued;
+vector<Time> inputs_applied;
+vector<Time> input_latencies;
+
+// window pixels per arrow key press and zoom factor per key press or wheel notch
+#define CAMERA_PAN_STEP 64
+#define CAMERA_ZOOM_STEP 1.25f
+
+void queueAction(int type, int target, int argument) {
+	Action action;
+	action.type = type;
+	action.target = target;
+	action.argument = argument;
+	if (!pushAction(&input_actions, &action)) {
+		SDL_Log("Action queue is full, dropping action");
+	}
+}
+
+// called once before every tick, so actions take effect at the next tick,
+// and with late_latch right before drawing, returns how many were applied
+int applyQueuedActions(GameData *gd) {
+	Action batch[ACTION_BATCH_SIZE];
+	int count;
+	int drained;
+	setMetric(&metrics.input_queue_depth, countActions(&input_actions));
+	// bounded, so busy producers cannot stall the game loop
+	for (drained = 0; drained < ACTION_QUEUE_SIZE; drained += count) {
+		count = popActions(&input_actions, batch, ACTION_BATCH_SIZE);
+		if (count == 0)
+			break;
+		for (int i = 0; i < count; ++i) {
+			if (remote != NULL) {
+				clientSendAction(remote, &batch[i]);
+			} else {
+				applyAction(gd, &batch[i]);
+			}
+		}
+	}
+	if (drained > 0) {
+		inputs_applied.insert(inputs_applied.end(), inputs_queued.begin(), inputs_queued.end());
+		inputs_queued.clear();
+	}
+	return drained;
+}
+
+// when SDL got the event on the getCurrentTime clock, SDL only keeps milliseconds
+Time getEventTime(const SDL_Event *e) {
+	Uint32 age = SDL_GetTicks() - e->common.timestamp;
+	return getCurrentTime() - millis(age);
+}
+
 void handleEvent(GameData *gd, const SDL_Event *e) {
     if (e->type == SDL_QUIT) {
         should_quit = true;
+	} else if (e->type == SDL_WINDOWEVENT) {
+		// whatever was on screen may be gone
+		gd->full_redraw = true;
 	} else if (e->type == SDL_KEYDOWN) {
-		if (e->key.keysym.sym == SDLK_r) {
-			resetGame(gd);
-		} else if (e->key.keysym.sym == SDLK_ESCAPE) {
+		SDL_Keycode key = e->key.keysym.sym;
+		if (key == SDLK_r) {
+			queueAction(ACTION_RESET, 0, 0);
+		} else if (key == SDLK_ESCAPE) {
 			should_quit = true;
-		} else if (e->key.keysym.sym == SDLK_b) {
-			placeBallInSpawn(gd, BALL_TYPE_GREEN, 0);
+		} else if (key == SDLK_b) {
+			// only works locally, the server has no message for it
+			queueAction(ACTION_SPAWN_BALL, 0, BALL_TYPE_GREEN);
+		} else if (key == SDLK_LEFT) {
+			panCamera(gd, CAMERA_PAN_STEP, 0);
+		} else if (key == SDLK_RIGHT) {
+			panCamera(gd, -CAMERA_PAN_STEP, 0);
+		} else if (key == SDLK_UP) {
+			panCamera(gd, 0, CAMERA_PAN_STEP);
+		} else if (key == SDLK_DOWN) {
+			panCamera(gd, 0, -CAMERA_PAN_STEP);
+		} else if (key == SDLK_PLUS || key == SDLK_EQUALS) {
+			zoomCamera(gd, CAMERA_ZOOM_STEP, gd->view_width / 2.0f, gd->view_height / 2.0f);
+		} else if (key == SDLK_MINUS) {
+			zoomCamera(gd, 1 / CAMERA_ZOOM_STEP, gd->view_width / 2.0f, gd->view_height / 2.0f);
+		} else if (key == SDLK_HOME) {
+			resetCamera(gd);
+		}
+	} else if (e->type == SDL_MOUSEWHEEL) {
+		// zoom about the mouse pointer
+		int mouse_x, mouse_y;
+		SDL_GetMouseState(&mouse_x, &mouse_y);
+		zoomCamera(gd, powf(CAMERA_ZOOM_STEP, (float)e->wheel.y), (float)mouse_x, (float)mouse_y);
+	} else if (e->type == SDL_MOUSEMOTION) {
+		// drag with the middle button to pan
+		if (e->motion.state & SDL_BUTTON_MMASK) {
+			panCamera(gd, (float)e->motion.xrel, (float)e->motion.yrel);
 		}
-	} else if (e->type == SDL_MOUSEBUTTONDOWN) {
+	} else if (e->type == SDL_MOUSEBUTTONDOWN && dashboard_boards == 0) {
 		//int type = gd->ball_types[gd->ball_type_index_next];
 		//placeBall(gd, (float)e->button.x, (float)e->button.y, 5.0, 0.0, type);
 		//gd->ball_type_index_next = (gd->ball_type_index_next + 1) % gd->ball_type_count;
-		for (int i = 0; i < gd->rotor_count; ++i) {
-			// check if we clicked this rotor
-			float mouse_x = (float)e->button.x - 0.5f;
-			float mouse_y = (float)e->button.y - 0.5f;
-			float rotor_x = gd->rotors[i].x;
-			float rotor_y = gd->rotors[i].y;
-			float x = mouse_x - rotor_x;
-			float y = mouse_y - rotor_y;
-			if (x < -30 || 30 < x || y < -30 || 30 < y) {
-				// not clicked this rotor at all
-				continue;
-			} else if (-10 < x && x < 10 && -10 < y && y < 10) {
-				// clicked rotor in the center -> turn rotor
-				int direction = -1;
-				if (e->button.button == 1)
-					direction = ROTOR_CLOCKWISE;
-				else if (e->button.button == 3)
-					direction = ROTOR_ANTICLOCKWISE;
-				if (direction != -1)
-					turnRotor(gd, i, direction);
-			} else if (e->button.button == 1) {
-				// clicked rotor a bit away from the center -> release ball
-				int position = -1;
-				if (x * x > y * y && x > 0) {
-					position = ROTOR_POSITION_RIGHT;
-					SDL_Log("Rotor %d was clicked right", i);
-				} else if (x * x > y * y && x < 0) {
-					position = ROTOR_POSITION_LEFT;
-					SDL_Log("Rotor %d was clicked left", i);
-				} else if (x * x < y * y && y < 0) {
-					position = ROTOR_POSITION_TOP;
-					SDL_Log("Rotor %d was clicked top", i);
-				} else if (x * x < y * y && y > 0) {
-					position = ROTOR_POSITION_BOTTOM;
-					SDL_Log("Rotor %d was clicked bottom", i);
-				}
-				if (position == -1)
-					return;
-				releaseBallFromRotor(gd, i, position);
+		float mouse_x, mouse_y;
+		screenToWorld(gd, (float)e->button.x - 0.5f, (float)e->button.y - 0.5f, &mouse_x, &mouse_y);
+		// check which rotor we clicked
+		int i = findRotorAt(gd, mouse_x, mouse_y);
+		if (i < 0)
+			return;
+		float x = mouse_x - gd->rotors[i].x;
+		float y = mouse_y - gd->rotors[i].y;
+		if (-10 < x && x < 10 && -10 < y && y < 10) {
+			// clicked rotor in the center -> turn rotor
+			int direction = -1;
+			if (e->button.button == 1)
+				direction = ROTOR_CLOCKWISE;
+			else if (e->button.button == 3)
+				direction = ROTOR_ANTICLOCKWISE;
+			if (direction != -1)
+				queueAction(ACTION_TURN_ROTOR, i, direction);
+		} else if (e->button.button == 1) {
+			// clicked rotor a bit away from the center -> release ball
+			int position = -1;
+			if (x * x > y * y && x > 0) {
+				position = ROTOR_POSITION_RIGHT;
+				SDL_Log("Rotor %d was clicked right", i);
+			} else if (x * x > y * y && x < 0) {
+				position = ROTOR_POSITION_LEFT;
+				SDL_Log("Rotor %d was clicked left", i);
+			} else if (x * x < y * y && y < 0) {
+				position = ROTOR_POSITION_TOP;
+				SDL_Log("Rotor %d was clicked top", i);
+			} else if (x * x < y * y && y > 0) {
+				position = ROTOR_POSITION_BOTTOM;
+				SDL_Log("Rotor %d was clicked bottom", i);
 			}
+			if (position == -1)
+				return;
+			queueAction(ACTION_RELEASE_BALL, i, position);
 		}
 	}
 }
@@ -66,44 +167,477 @@ void handleEvent(GameData *gd, const SDL_Event *e) {
 void handleAllEvents(GameData *gd) {
     SDL_Event e;
     while (!should_quit && SDL_PollEvent(&e)) {
+		int queued = countActions(&input_actions);
+		float camera_x = gd->camera_x;
+		float camera_y = gd->camera_y;
+		float zoom = gd->zoom;
 		handleEvent(gd, &e);
+		// only events that changed something count for the latency
+		if (countActions(&input_actions) > queued) {
+			inputs_queued.push_back(getEventTime(&e));
+		} else if (gd->camera_x != camera_x || gd->camera_y != camera_y || gd->zoom != zoom) {
+			inputs_applied.push_back(getEventTime(&e));
+		}
     }
 }
 
+int runServerOnly(const char *address, Time tick_time, bool fixed_point, bool line_spacing) {
+	if (startNet() != 0)
+		return 1;
+	Server server;
+	if (startServer(&server, address, tick_time) != 0) {
+		stopNet();
+		return 1;
+	}
+	server.fixed_point = fixed_point;
+	server.line_spacing = line_spacing;
+	runServer(&server);
+	stopServer(&server);
+	stopNet();
+	return 0;
+}
+
+// how often --metrics-file is rewritten
+#define METRICS_FILE_INTERVAL seconds(15)
+
+// simulation runs at a fixed rate, independent of how often frames are drawn
+#define TICKS_PER_SECOND 60
+// ticks a slow frame may catch up on, beyond that the game slows down instead
+#define MAX_CATCH_UP_TICKS 5
+
+// startup phases, to keep an eye on the time to the first frame
+struct StartupTimes {
+	Time launch;
+	Time sdl_ready;
+	Time window_ready;
+	Time map_ready;
+	// spent building the map, alongside the window
+	Time map_build;
+	Time services_ready;
+	Time first_frame;
+};
+
+static double toMillis(Time t) {
+	return t / 1000.0;
+}
+
+void logStartupTimes(const StartupTimes *times) {
+	SDL_Log("Startup: SDL %.1f ms, window %.1f ms, map %.1f ms (%.1f ms building in parallel), services %.1f ms, first frame %.1f ms",
+		toMillis(times->sdl_ready - times->launch), toMillis(times->window_ready - times->sdl_ready),
+		toMillis(times->map_ready - times->window_ready), toMillis(times->map_build),
+		toMillis(times->services_ready - times->map_ready), toMillis(times->first_frame - times->services_ready));
+	SDL_Log("Time to first frame: %.1f ms", toMillis(times->first_frame - times->launch));
+}
+
+// right after a present, everything applied so far is on screen now
+void recordInputLatency() {
+	Time presented = getCurrentTime();
+	for (size_t i = 0; i < inputs_applied.size(); ++i) {
+		Time latency = presented - inputs_applied[i];
+		observeDuration(&metrics.input_latency, latency);
+		input_latencies.push_back(latency);
+	}
+	inputs_applied.clear();
+}
+
+static Time getPercentile(const vector<Time> &sorted, int percent) {
+	size_t index = (sorted.size() - 1) * percent / 100;
+	return sorted[index];
+}
+
+void logInputLatency() {
+	if (input_latencies.empty())
+		return;
+	sort(input_latencies.begin(), input_latencies.end());
+	SDL_Log("Input to present: %d inputs, median %.1f ms, 90%% %.1f ms, 99%% %.1f ms, worst %.1f ms%s",
+		(int)input_latencies.size(), toMillis(getPercentile(input_latencies, 50)), toMillis(getPercentile(input_latencies, 90)),
+		toMillis(getPercentile(input_latencies, 99)), toMillis(input_latencies.back()), late_latch ? " (late latch)" : "");
+}
+
+// late-latched turns are drawn where the balls are now, instead of sliding
+// there from where they were at the last tick
+void stopInterpolatingRotorBalls(GameData *gd) {
+	for (int i = 0; i < gd->ball_end; ++i) {
+		if (gd->balls[i].type != BALL_TYPE_NONE && gd->balls[i].connector.type == CONNECTOR_ROTOR) {
+			gd->balls[i].has_prev = false;
+		}
+	}
+}
+
 int main(int argc, char *argv[]) {
-	// init SDL
-	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER | SDL_INIT_EVENTS);
+	StartupTimes startup;
+	startup.launch = getCurrentTime();
+	startup.map_build = 0;
+
+	// command line
+	int thread_count = 1;
+	const char *server_address = NULL;
+	const char *connect_address = NULL;
+	int session = 0;
+	int map_number = 4;
+	uint32 seed = 42;
+	MapParams map_params;
+	setDefaultMapParams(&map_params);
+	const char *map_path = NULL;
+	const char *save_map_path = NULL;
+	const char *export_name = NULL;
+	const char *metrics_address = NULL;
+	const char *metrics_path = NULL;
+	const char *capture_path = NULL;
+	int capture_format = CAPTURE_PNG;
+	int64 frame_limit = -1;
+	int target_fps = 60;
+	// 0 for the default size
+	int window_width = 0;
+	int window_height = 0;
+	bool offline = false;
+	bool dirty_rects = false;
+	bool display_info = false;
+	bool fixed_point = false;
+	bool line_spacing = false;
+	bool mute = false;
+	int audio_buffer = 256;
+	int64 lockstep_ticks = 0;
+	int lockstep_seeds = 0;
+	bool lockstep_parallel = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			thread_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+			server_address = argv[++i];
+		} else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+			connect_address = argv[++i];
+		} else if (strcmp(argv[i], "--session") == 0 && i + 1 < argc) {
+			session = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+			map_number = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			seed = (uint32)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--generate") == 0 && i + 2 < argc) {
+			map_number = MAP_GENERATED;
+			map_params.columns = atoi(argv[++i]);
+			map_params.rows = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--spawns") == 0 && i + 1 < argc) {
+			map_params.spawn_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--connectivity") == 0 && i + 1 < argc) {
+			map_params.connectivity = (float)atof(argv[++i]);
+		} else if (strcmp(argv[i], "--map-seed") == 0 && i + 1 < argc) {
+			map_params.seed = (uint32)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--load-map") == 0 && i + 1 < argc) {
+			map_number = MAP_FILE;
+			map_path = argv[++i];
+		} else if (strcmp(argv[i], "--save-map") == 0 && i + 1 < argc) {
+			save_map_path = argv[++i];
+		} else if (strcmp(argv[i], "--export-state") == 0 && i + 1 < argc) {
+			export_name = argv[++i];
+		} else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+			// e.g. tcp:9100, for Prometheus to scrape
+			metrics_address = argv[++i];
+		} else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+			// for the textfile collector of the node exporter
+			metrics_path = argv[++i];
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_path = argv[++i];
+		} else if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "raw") == 0) {
+				capture_format = CAPTURE_RAW;
+			} else if (strcmp(argv[i], "y4m") == 0) {
+				capture_format = CAPTURE_Y4M;
+			} else {
+				capture_format = CAPTURE_PNG;
+			}
+		} else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+			// drawing rate, e.g. the refresh rate of the display
+			target_fps = atoi(argv[++i]);
+			target_fps = SDL_max(target_fps, 1);
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frame_limit = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--window") == 0 && i + 2 < argc) {
+			window_width = atoi(argv[++i]);
+			window_height = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--dashboard") == 0 && i + 1 < argc) {
+			// that many games side by side, each with a random player
+			dashboard_boards = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--dirty-rects") == 0) {
+			// for software rendering and remote desktops
+			dirty_rects = true;
+		} else if (strcmp(argv[i], "--fixed-point") == 0) {
+			// same results on every platform, for replays and lockstep
+			fixed_point = true;
+		} else if (strcmp(argv[i], "--line-spacing") == 0) {
+			// balls on a line keep apart and queue up behind a blocked one
+			line_spacing = true;
+		} else if (strcmp(argv[i], "--late-latch") == 0) {
+			// clicks that arrive while the frame is computed still make it into the frame
+			late_latch = true;
+		} else if (strcmp(argv[i], "--mute") == 0) {
+			mute = true;
+		} else if (strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc) {
+			// frames per audio buffer, smaller is quicker but may crackle
+			audio_buffer = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+			// check the engine against the reference engine for that many ticks per seed
+			lockstep_ticks = atoll(argv[++i]);
+		} else if (strcmp(argv[i], "--lockstep-seeds") == 0 && i + 1 < argc) {
+			lockstep_seeds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--lockstep-engine") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "serial") == 0) {
+				lockstep_parallel = false;
+			} else if (strcmp(argv[i], "parallel") == 0) {
+				lockstep_parallel = true;
+			} else {
+				SDL_Log("Unknown lockstep engine: %s", argv[i]);
+			}
+		} else if (strcmp(argv[i], "--display-info") == 0) {
+			// list every mode of every display, slow with many monitors
+			display_info = true;
+		} else if (strcmp(argv[i], "--offline") == 0) {
+			// as fast as possible, without showing anything
+			offline = true;
+		} else {
+			SDL_Log("Unknown argument: %s", argv[i]);
+		}
+	}
+
+	// operational metrics
+	if (metrics_address != NULL && (startNet() != 0 || startMetricsServer(metrics_address) != 0)) {
+		SDL_Log("Serving metrics failed, continuing without");
+	}
+	if (metrics_path != NULL) {
+		startMetricsFile(metrics_path, METRICS_FILE_INTERVAL);
+	}
 
-	// game data
-	GameData gd;
+	// headless server, no window needed
+	if (server_address != NULL) {
+		int result = runServerOnly(server_address, seconds(1) / TICKS_PER_SECOND, fixed_point, line_spacing);
+		stopMetrics();
+		return result;
+	}
+
+	// differential check, no window needed either
+	if (lockstep_ticks > 0) {
+		startWorkers(thread_count);
+		LockstepParams params;
+		params.map_number = map_number;
+		params.map_params = map_params;
+		params.map_path = map_path;
+		params.fixed_point = fixed_point;
+		params.first_seed = seed;
+		// enough seeds to keep every thread busy
+		params.seed_count = lockstep_seeds > 0 ? lockstep_seeds : getWorkerCount() * 4;
+		params.tick_count = lockstep_ticks;
+		params.tick = lockstep_parallel ? progressLogicParallel : progressLogic;
+		params.tick_uses_workers = lockstep_parallel;
+		int result = runLockstep(&params);
+		stopWorkers();
+		stopMetrics();
+		return result;
+	}
+
+	// init SDL, anything beyond video is started by whoever needs it
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+	startup.sdl_ready = getCurrentTime();
+
+	// game data, static because it gets large with LOGICAL_LARGE_MAPS
+	static GameData gd;
+	gd.dirty_rects = dirty_rects;
+	gd.view_width = window_width;
+	gd.view_height = window_height;
+	gd.fixed_point = fixed_point;
+	gd.line_spacing = line_spacing;
+	gd.map_params = map_params;
+	if (map_path != NULL) {
+		SDL_strlcpy(gd.map_path, map_path, sizeof(gd.map_path));
+	}
+
+	// build the map while the window is being created, they share nothing
+	thread map_builder;
+	int map_result = 0;
+	if (connect_address == NULL) {
+		map_builder = thread([&] {
+			Time build_start = getCurrentTime();
+			map_result = newGame(&gd, map_number, seed);
+			if (map_result == 0 && save_map_path != NULL) {
+				saveMap(&gd, save_map_path);
+			}
+			startup.map_build = getCurrentTime() - build_start;
+		});
+	}
+
+	if (display_info) {
+		printAllDisplaysInfo();
+	}
 
 	// start renderer
-	if (startGraphics(&gd) != 0) {
+	int graphics_result = startGraphics(&gd);
+	startup.window_ready = getCurrentTime();
+	if (map_builder.joinable()) {
+		map_builder.join();
+	}
+	startup.map_ready = getCurrentTime();
+	if (graphics_result != 0) {
 		SDL_Log("Error during graphics initialization, quitting...");
 		stopGraphics(&gd);
 		return 1;
 	}
+	if (map_result != 0) {
+		SDL_Log("Error building the map, quitting...");
+		stopGraphics(&gd);
+		return 1;
+	}
 
 	// timer stuff
 	Time start_time = getCurrentTime();
-	int target_fps = 60;
 	Time time_per_frame = seconds(1) / target_fps;
+	Time tick_time = seconds(1) / TICKS_PER_SECOND;
+	// simulation time still owed to the game
+	Time accumulator = 0;
+	Time last_clock = 0;
 	int64 frame = 0;
+	Time last_frame_start = 0;
+
+	// record frames
+	if (capture_path != NULL && startCapture(&gd, capture_path, capture_format, target_fps, offline) != 0) {
+		SDL_Log("Error starting capture, quitting...");
+		stopGraphics(&gd);
+		return 1;
+	}
+
+	startActionQueue(&input_actions, ACTION_QUEUE_SIZE);
 
-	// reset game
-	resetGame(&gd);
+	// sound effects, not for recordings or runs without a window
+	if (!mute && !offline && capture_path == NULL) {
+		startAudio(&gd, audio_buffer);
+	}
+
+	// worker threads for the simulation
+	startWorkers(thread_count);
+
+	// many games at once, the screen game is the first of them
+	if (dashboard_boards > 0 && connect_address != NULL) {
+		SDL_Log("The dashboard only shows local games, showing the server game alone");
+		dashboard_boards = 0;
+	} else if (dashboard_boards > 0) {
+		startDashboard(&gd, dashboard_boards);
+	}
+
+	// publish the state of every tick for external tools
+	if (export_name != NULL) {
+		startStateExport(export_name);
+	}
+
+	// start game, either locally or on a server
+	Client client;
+	if (connect_address != NULL) {
+		if (startNet() != 0 || connectClient(&client, connect_address, &gd) != 0) {
+			SDL_Log("Error connecting to %s, quitting...", connect_address);
+			stopGraphics(&gd);
+			return 1;
+		}
+		remote = &client;
+		// nothing to show until the first keyframe arrives
+		clearGame(&gd);
+		if (session > 0) {
+			clientSubscribe(&client, session);
+		} else {
+			clientOpenSession(&client, map_number, seed);
+		}
+	}
+	startup.services_ready = getCurrentTime();
 
 	// game loop
     while (!should_quit) {
 		Time frame_time = frame * time_per_frame;
+		Time frame_start = getCurrentTime();
+		if (frame > 0) {
+			observeDuration(&metrics.frame_duration, frame_start - last_frame_start);
+		}
+		last_frame_start = frame_start;
 		handleAllEvents(&gd);
-		progressLogic(&gd, time_per_frame);
-		renderEverything(&gd);
+		if (remote != NULL) {
+			// the server ticks, there is nothing in between to draw
+			applyQueuedActions(&gd);
+			if (pollClient(remote) < 0) {
+				SDL_Log("Lost connection to server");
+				should_quit = true;
+			}
+			exportState(&gd);
+			gd.interpolation = 1.0f;
+		} else {
+			// offline runs on frame time, so every run turns out the same
+			Time clock = offline ? (frame + 1) * time_per_frame : getCurrentTime() - start_time;
+			accumulator += clock - last_clock;
+			last_clock = clock;
+			int ticks = 0;
+			while (accumulator >= tick_time) {
+				if (ticks == MAX_CATCH_UP_TICKS) {
+					// too far behind, drop the rest rather than fall further behind
+					accumulator %= tick_time;
+					break;
+				}
+				applyQueuedActions(&gd);
+				if (dashboard_boards > 0) {
+					tickDashboard(tick_time);
+				} else {
+					rememberBallPositions(&gd);
+					progressLogicParallel(&gd, tick_time);
+				}
+				exportState(&gd);
+				accumulator -= tick_time;
+				++ticks;
+			}
+			gd.interpolation = (float)accumulator / tick_time;
+		}
+		if (late_latch && !offline) {
+			// between two ticks, so the state is the same as if they came with the next one
+			handleAllEvents(&gd);
+			if (applyQueuedActions(&gd) > 0 && remote == NULL) {
+				stopInterpolatingRotorBalls(&gd);
+			}
+		}
+		playEventSounds(&gd);
+		if (capture_path != NULL) {
+			captureFrame(&gd);
+		} else if (!offline && dashboard_boards > 0) {
+			renderDashboard(&gd);
+		} else if (!offline) {
+			renderEverything(&gd);
+		}
+		if (!offline) {
+			recordInputLatency();
+		} else {
+			inputs_applied.clear();
+		}
+		if (frame == 0) {
+			startup.first_frame = getCurrentTime();
+			logStartupTimes(&startup);
+		}
+		countMetric(&metrics.frames);
+		pollMetrics();
 		++frame;
-		sleepUntil(start_time + frame_time);
+		if (frame == frame_limit) {
+			should_quit = true;
+		}
+		if (!offline) {
+			sleepUntil(start_time + frame_time);
+		}
     }
 
 	// finishing
+	logInputLatency();
+	if (remote != NULL) {
+		disconnectClient(remote);
+		stopNet();
+	}
+	stopCapture(&gd);
+	stopStateExport();
+	stopMetrics();
+	stopAudio(&gd);
+	stopDashboard();
+	stopWorkers();
+	stopActionQueue(&input_actions);
 	stopGraphics(&gd);
 	SDL_Quit();
 	return 0;
@@ -0,0 +1,335 @@
+#include "logical.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+// generated maps
+
+void setDefaultMapParams(MapParams *params) {
+	// fits the limits of a build without LOGICAL_LARGE_MAPS
+	params->columns = 6;
+	params->rows = 4;
+	params->spacing = 100.0;
+	params->connectivity = 0.7f;
+	params->spawn_count = 1;
+	params->seed = 1;
+}
+
+// A track runs above the rotors of columns [column_begin, column_end) of the
+// top row, first from right to left and then back. Every time it passes a
+// rotor an inserter tries to put the ball into the top of it, otherwise the
+// ball moves on. At the end it starts over.
+static int placeTrack(GameData *gd, int first_rotor, int column_begin, int column_end, float track_y, float spacing) {
+	int n = column_end - column_begin;
+	int segment_count = 2 * n + 2;
+	int first_line = gd->line_count;
+
+	// the points the track goes through, the rotor columns lie in between the two ends
+	float x_left = gd->rotors[first_rotor + column_begin].x - spacing / 2;
+	float x_right = gd->rotors[first_rotor + column_end - 1].x + spacing / 2;
+	float x_prev = x_right;
+	for (int k = 0; k < segment_count; ++k) {
+		float x_next;
+		int column = -1;
+		if (k < n) {
+			column = column_end - 1 - k;
+			x_next = gd->rotors[first_rotor + column].x;
+		} else if (k == n) {
+			x_next = x_left;
+		} else if (k < 2 * n + 1) {
+			column = column_begin + (k - n - 1);
+			x_next = gd->rotors[first_rotor + column].x;
+		} else {
+			x_next = x_right;
+		}
+
+		int line_index = addLine(gd);
+		gd->lines[line_index].x1 = x_prev;
+		gd->lines[line_index].y1 = track_y;
+		gd->lines[line_index].x2 = x_next;
+		gd->lines[line_index].y2 = track_y;
+		int next_line = first_line + (k + 1) % segment_count;
+
+		if (column >= 0) {
+			int inserter_index = addInserter(gd);
+			gd->inserters[inserter_index].connector_success.type = CONNECTOR_ROTOR;
+			gd->inserters[inserter_index].connector_success.target = first_rotor + column;
+			gd->inserters[inserter_index].connector_success.rotor.position = ROTOR_POSITION_TOP;
+			gd->inserters[inserter_index].connector_failure.type = CONNECTOR_LINE;
+			gd->inserters[inserter_index].connector_failure.target = next_line;
+			gd->lines[line_index].connector.type = CONNECTOR_INSERTER;
+			gd->lines[line_index].connector.target = inserter_index;
+		} else {
+			gd->lines[line_index].connector.type = CONNECTOR_LINE;
+			gd->lines[line_index].connector.target = next_line;
+		}
+		x_prev = x_next;
+	}
+	return first_line;
+}
+
+int generateMap(GameData *gd, const MapParams *params) {
+	int columns = params->columns;
+	int rows = params->rows;
+	int spawn_count = SDL_min(params->spawn_count, columns);
+	if (columns < 1 || rows < 1 || spawn_count < 1) {
+		SDL_Log("Generating map failed, it would be empty");
+		return -1;
+	}
+
+	// every connection between two rotors takes two lines
+	int rotors_needed = columns * rows;
+	int lines_needed = 4 * columns * rows + 2 * columns + 2 * spawn_count;
+	int inserters_needed = 2 * columns;
+	if (gd->rotor_count + rotors_needed > NROTORS || gd->line_count + lines_needed > NLINES ||
+		gd->inserter_count + inserters_needed > NINSERTERS || gd->spawn_count + spawn_count > NSPAWNS) {
+		SDL_Log("Generating map failed, %dx%d rotors with %d spawns do not fit", columns, rows, spawn_count);
+		return -1;
+	}
+
+	Random random;
+	random_seed(&random, params->seed);
+	float spacing = params->spacing;
+
+	// rotors, leaving room for the tracks above them
+	int first_rotor = gd->rotor_count;
+	for (int row = 0; row < rows; ++row) {
+		for (int column = 0; column < columns; ++column) {
+			placeRotor(gd, spacing * (column + 1), spacing * (row + 1));
+		}
+	}
+
+	// connections to the right and downwards
+	uint32 threshold = (uint32)(params->connectivity * 1000);
+	for (int row = 0; row < rows; ++row) {
+		for (int column = 0; column < columns; ++column) {
+			int rotor_index = first_rotor + row * columns + column;
+			if (column + 1 < columns && random_get(&random) % 1000 < threshold) {
+				placeLineBetweenRotors(gd, rotor_index, rotor_index + 1);
+			}
+			if (row + 1 < rows && random_get(&random) % 1000 < threshold) {
+				placeLineBetweenRotors(gd, rotor_index, rotor_index + columns);
+			}
+		}
+	}
+
+	// spawns share the top row between them
+	for (int i = 0; i < spawn_count; ++i) {
+		int column_begin = i * columns / spawn_count;
+		int column_end = (i + 1) * columns / spawn_count;
+		int first_line = placeTrack(gd, first_rotor, column_begin, column_end, spacing / 2, spacing);
+		int spawn_index = addSpawn(gd);
+		gd->spawns[spawn_index].connector.type = CONNECTOR_LINE;
+		gd->spawns[spawn_index].connector.target = first_line;
+	}
+
+	SDL_Log("Generated map with %d rotors, %d lines and %d spawns", gd->rotor_count, gd->line_count, gd->spawn_count);
+	return 0;
+}
+
+// map files
+//
+// Plain text, one object per line, in the order of their indices:
+//
+//   logical-map 1
+//   rotors <count>
+//   <x> <y> <connector right> <connector top> <connector left> <connector bottom>
+//   lines <count>
+//   <x1> <y1> <x2> <y2> <connector>
+//   inserters <count>
+//   <connector success> <connector failure>
+//   spawns <count>
+//   <connector>
+//
+// where a connector is one of "wall", "free", "line <index>",
+// "rotor <index> <position>", "inserter <index>" or "spawn <index>".
+
+static void writeConnector(FILE *file, const Connector *connector) {
+	if (connector->type == CONNECTOR_LINE) {
+		fprintf(file, " line %d", connector->target);
+	} else if (connector->type == CONNECTOR_ROTOR) {
+		fprintf(file, " rotor %d %d", connector->target, connector->rotor.position);
+	} else if (connector->type == CONNECTOR_INSERTER) {
+		fprintf(file, " inserter %d", connector->target);
+	} else if (connector->type == CONNECTOR_SPAWN) {
+		fprintf(file, " spawn %d", connector->target);
+	} else if (connector->type == CONNECTOR_FREE) {
+		fprintf(file, " free");
+	} else {
+		fprintf(file, " wall");
+	}
+}
+
+static bool readConnector(FILE *file, Connector *connector) {
+	char type[16];
+	if (fscanf(file, "%15s", type) != 1)
+		return false;
+	connector->target = 0;
+	if (strcmp(type, "line") == 0) {
+		connector->type = CONNECTOR_LINE;
+	} else if (strcmp(type, "rotor") == 0) {
+		connector->type = CONNECTOR_ROTOR;
+		return fscanf(file, "%d %d", &connector->target, &connector->rotor.position) == 2;
+	} else if (strcmp(type, "inserter") == 0) {
+		connector->type = CONNECTOR_INSERTER;
+	} else if (strcmp(type, "spawn") == 0) {
+		connector->type = CONNECTOR_SPAWN;
+	} else if (strcmp(type, "free") == 0) {
+		connector->type = CONNECTOR_FREE;
+		return true;
+	} else if (strcmp(type, "wall") == 0) {
+		connector->type = CONNECTOR_WALL;
+		return true;
+	} else {
+		return false;
+	}
+	return fscanf(file, "%d", &connector->target) == 1;
+}
+
+static bool checkConnector(const GameData *gd, const Connector *connector) {
+	if (connector->type == CONNECTOR_LINE) {
+		return connector->target >= 0 && connector->target < gd->line_count;
+	} else if (connector->type == CONNECTOR_ROTOR) {
+		return connector->target >= 0 && connector->target < gd->rotor_count
+			&& connector->rotor.position >= 0 && connector->rotor.position < 4;
+	} else if (connector->type == CONNECTOR_INSERTER) {
+		return connector->target >= 0 && connector->target < gd->inserter_count;
+	} else if (connector->type == CONNECTOR_SPAWN) {
+		return connector->target >= 0 && connector->target < gd->spawn_count;
+	}
+	return true;
+}
+
+// connectors may point at objects further down the file, so this comes last
+static bool checkConnectors(const GameData *gd) {
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		for (int pos = 0; pos < 4; ++pos) {
+			if (!checkConnector(gd, &gd->rotors[i].connectors[pos]))
+				return false;
+		}
+	}
+	for (int i = 0; i < gd->line_count; ++i) {
+		if (!checkConnector(gd, &gd->lines[i].connector))
+			return false;
+	}
+	for (int i = 0; i < gd->inserter_count; ++i) {
+		if (!checkConnector(gd, &gd->inserters[i].connector_success) || !checkConnector(gd, &gd->inserters[i].connector_failure))
+			return false;
+	}
+	for (int i = 0; i < gd->spawn_count; ++i) {
+		if (!checkConnector(gd, &gd->spawns[i].connector))
+			return false;
+	}
+	return true;
+}
+
+int saveMap(const GameData *gd, const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		SDL_Log("Opening %s for writing failed", path);
+		return -1;
+	}
+
+	fprintf(file, "logical-map 1\n");
+	fprintf(file, "rotors %d\n", gd->rotor_count);
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		fprintf(file, "%.9g %.9g", gd->rotors[i].x, gd->rotors[i].y);
+		for (int pos = 0; pos < 4; ++pos) {
+			writeConnector(file, &gd->rotors[i].connectors[pos]);
+		}
+		fprintf(file, "\n");
+	}
+	fprintf(file, "lines %d\n", gd->line_count);
+	for (int i = 0; i < gd->line_count; ++i) {
+		const Line *line = &gd->lines[i];
+		fprintf(file, "%.9g %.9g %.9g %.9g", line->x1, line->y1, line->x2, line->y2);
+		writeConnector(file, &line->connector);
+		fprintf(file, "\n");
+	}
+	fprintf(file, "inserters %d\n", gd->inserter_count);
+	for (int i = 0; i < gd->inserter_count; ++i) {
+		writeConnector(file, &gd->inserters[i].connector_success);
+		writeConnector(file, &gd->inserters[i].connector_failure);
+		fprintf(file, "\n");
+	}
+	fprintf(file, "spawns %d\n", gd->spawn_count);
+	for (int i = 0; i < gd->spawn_count; ++i) {
+		writeConnector(file, &gd->spawns[i].connector);
+		fprintf(file, "\n");
+	}
+
+	bool failed = ferror(file) != 0;
+	fclose(file);
+	if (failed) {
+		SDL_Log("Writing %s failed", path);
+		return -1;
+	}
+	return 0;
+}
+
+// reads "<name> <count>" and checks that count more objects fit
+static int readSection(FILE *file, const char *name, int used, int capacity) {
+	char found[16];
+	int count;
+	if (fscanf(file, "%15s %d", found, &count) != 2 || strcmp(found, name) != 0 || count < 0)
+		return -1;
+	if (used + count > capacity) {
+		SDL_Log("Map has %d %s, but only %d fit", count, name, capacity - used);
+		return -1;
+	}
+	return count;
+}
+
+int loadMap(GameData *gd, const char *path) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		SDL_Log("Opening map %s failed", path);
+		return -1;
+	}
+
+	char magic[16];
+	int version;
+	bool ok = fscanf(file, "%15s %d", magic, &version) == 2 && strcmp(magic, "logical-map") == 0 && version == 1;
+
+	int count = ok ? readSection(file, "rotors", gd->rotor_count, NROTORS) : -1;
+	ok = ok && count >= 0;
+	for (int i = 0; ok && i < count; ++i) {
+		float x, y;
+		ok = fscanf(file, "%f %f", &x, &y) == 2;
+		if (!ok)
+			break;
+		int rotor_index = placeRotor(gd, x, y);
+		for (int pos = 0; ok && pos < 4; ++pos) {
+			ok = readConnector(file, &gd->rotors[rotor_index].connectors[pos]);
+		}
+	}
+
+	count = ok ? readSection(file, "lines", gd->line_count, NLINES) : -1;
+	ok = ok && count >= 0;
+	for (int i = 0; ok && i < count; ++i) {
+		Line *line = &gd->lines[addLine(gd)];
+		ok = fscanf(file, "%f %f %f %f", &line->x1, &line->y1, &line->x2, &line->y2) == 4 && readConnector(file, &line->connector);
+	}
+
+	count = ok ? readSection(file, "inserters", gd->inserter_count, NINSERTERS) : -1;
+	ok = ok && count >= 0;
+	for (int i = 0; ok && i < count; ++i) {
+		Inserter *inserter = &gd->inserters[addInserter(gd)];
+		ok = readConnector(file, &inserter->connector_success) && readConnector(file, &inserter->connector_failure);
+	}
+
+	count = ok ? readSection(file, "spawns", gd->spawn_count, NSPAWNS) : -1;
+	ok = ok && count >= 0;
+	for (int i = 0; ok && i < count; ++i) {
+		ok = readConnector(file, &gd->spawns[addSpawn(gd)].connector);
+	}
+
+	fclose(file);
+	ok = ok && checkConnectors(gd);
+	if (!ok) {
+		SDL_Log("Map %s is broken", path);
+		return -1;
+	}
+	SDL_Log("Loaded map %s with %d rotors and %d lines", path, gd->rotor_count, gd->line_count);
+	return 0;
+}
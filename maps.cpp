@@ -9,6 +9,7 @@ int placeRotor(GameData *gd, float x, float y) {
 		gd->rotors[rotor_index].connectors[pos].type = CONNECTOR_WALL;
 		gd->rotors[rotor_index].balls[pos] = -1;
 	}
+	gd->rotors[rotor_index].slots = 0;
 	gd->rotors[rotor_index].destroyed = false;
 	return rotor_index;
 }
@@ -188,6 +189,7 @@ void buildMap2(GameData *gd) {
 	gd->rotors[rotor_index].balls[ROTOR_POSITION_TOP] = -1;
 	gd->rotors[rotor_index].balls[ROTOR_POSITION_LEFT] = -1;
 	gd->rotors[rotor_index].balls[ROTOR_POSITION_BOTTOM] = -1;
+	gd->rotors[rotor_index].slots = 0;
 	
 	gd->lines[line_index + 0].x1 = 400 + 15;
 	gd->lines[line_index + 0].x2 = 400 + 15 + 200;
@@ -254,14 +256,12 @@ void buildMap2(GameData *gd) {
 	gd->balls[ball_index].connector.type = CONNECTOR_ROTOR;
 	gd->balls[ball_index].connector.rotor.position = ROTOR_POSITION_RIGHT;
 	gd->balls[ball_index].connector.target = gd->rotor_count;
-	gd->rotors[gd->rotor_count].balls[ROTOR_POSITION_RIGHT] = ball_index;
-	updateBallPosition(gd, ball_index);
+	setRotorBall(gd, gd->rotor_count, ROTOR_POSITION_RIGHT, ball_index);
 	ball_index = placeBallFree(gd, BALL_TYPE_RED, 0, 0, 0, 0);
 	gd->balls[ball_index].connector.type = CONNECTOR_ROTOR;
 	gd->balls[ball_index].connector.rotor.position = ROTOR_POSITION_LEFT;
 	gd->balls[ball_index].connector.target = gd->rotor_count;
-	gd->rotors[gd->rotor_count].balls[ROTOR_POSITION_LEFT] = ball_index;
-	updateBallPosition(gd, ball_index);
+	setRotorBall(gd, gd->rotor_count, ROTOR_POSITION_LEFT, ball_index);
 
 	gd->rotor_count += 1;
 	gd->line_count += 8;
@@ -346,3 +346,23 @@ void buildMap4(GameData *gd) {
 	gd->spawns[spawn_index].connector.type = CONNECTOR_LINE;
 	gd->spawns[spawn_index].connector.target = line_indices[0];
 }
+
+int buildMap(GameData *gd, int map_number) {
+	if (map_number == 1) {
+		buildMap1(gd);
+	} else if (map_number == 2) {
+		buildMap2(gd);
+	} else if (map_number == 3) {
+		buildMap3(gd);
+	} else if (map_number == 4) {
+		buildMap4(gd);
+	} else if (map_number == MAP_GENERATED) {
+		return generateMap(gd, &gd->map_params);
+	} else if (map_number == MAP_FILE) {
+		return loadMap(gd, gd->map_path);
+	} else {
+		SDL_Log("There is no map %d", map_number);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,227 @@
+#include "metrics.hpp"
+#include "net.hpp"
+
+#include <SDL2/SDL.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+	#include <windows.h>
+#endif
+
+using namespace std;
+
+Metrics metrics;
+
+static const Time bucket_bounds[METRICS_BUCKETS - 1] = {
+	100, 250, 500, 1000, 2000, 4000, 8000, 16667, 33333, 100000, 1000000,
+};
+
+// a scrape waiting for its request to arrive or its answer to be sent
+struct MetricsConnection {
+	Socket socket;
+	Time accepted;
+	string input;
+	string output;
+	size_t sent;
+};
+
+// give up on scrapers that take longer than this
+#define METRICS_CONNECTION_TIMEOUT seconds(2)
+
+static const char *file_path = NULL;
+static Time file_interval = 0;
+static Time next_file_write = 0;
+static Socket listener = SOCKET_NONE;
+static vector<MetricsConnection> connections;
+static bool rate_started = false;
+static Time rate_start = 0;
+static uint64 rate_ticks = 0;
+
+void observeDuration(MetricsHistogram *histogram, Time duration) {
+	int bucket = 0;
+	while (bucket < METRICS_BUCKETS - 1 && duration > bucket_bounds[bucket]) {
+		++bucket;
+	}
+	histogram->buckets[bucket].fetch_add(1, memory_order_relaxed);
+	histogram->count.fetch_add(1, memory_order_relaxed);
+	histogram->sum.fetch_add(duration > 0 ? (uint64)duration : 0, memory_order_relaxed);
+}
+
+static void appendLine(string *text, const char *format, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, format);
+	SDL_vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	*text += line;
+}
+
+static void appendCounter(string *text, const char *name, const char *help, const atomic<uint64> *value) {
+	appendLine(text, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	appendLine(text, "%s %llu\n", name, (unsigned long long)value->load(memory_order_relaxed));
+}
+
+static void appendGauge(string *text, const char *name, const char *help, const atomic<int64> *value) {
+	appendLine(text, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+	appendLine(text, "%s %lld\n", name, (long long)value->load(memory_order_relaxed));
+}
+
+static void appendHistogram(string *text, const char *name, const char *help, const MetricsHistogram *histogram) {
+	appendLine(text, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	// read count first, so that it never exceeds the +Inf bucket by much
+	uint64 count = histogram->count.load(memory_order_relaxed);
+	uint64 sum = histogram->sum.load(memory_order_relaxed);
+	uint64 cumulative = 0;
+	for (int i = 0; i < METRICS_BUCKETS - 1; ++i) {
+		cumulative += histogram->buckets[i].load(memory_order_relaxed);
+		appendLine(text, "%s_bucket{le=\"%g\"} %llu\n", name, bucket_bounds[i] / 1e6, (unsigned long long)cumulative);
+	}
+	cumulative += histogram->buckets[METRICS_BUCKETS - 1].load(memory_order_relaxed);
+	appendLine(text, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+	appendLine(text, "%s_sum %.6f\n", name, sum / 1e6);
+	appendLine(text, "%s_count %llu\n", name, (unsigned long long)count);
+}
+
+void formatMetrics(string *text) {
+	text->clear();
+	appendCounter(text, "logical_balls_allocated_total", "Balls added to the game.", &metrics.balls_allocated);
+	appendCounter(text, "logical_balls_freed_total", "Balls removed from the game.", &metrics.balls_freed);
+	appendCounter(text, "logical_ball_allocation_failures_total", "Balls that could not be added because all were in use.", &metrics.ball_allocation_failures);
+	appendCounter(text, "logical_rotors_destroyed_total", "Rotors destroyed by four balls of the same type.", &metrics.rotors_destroyed);
+	appendCounter(text, "logical_ticks_total", "Simulation ticks.", &metrics.ticks);
+	appendCounter(text, "logical_frames_total", "Frames drawn.", &metrics.frames);
+	appendGauge(text, "logical_ticks_per_second", "Simulation ticks during the last second.", &metrics.ticks_per_second);
+	appendGauge(text, "logical_input_queue_depth", "Player actions waiting for the next tick.", &metrics.input_queue_depth);
+	appendHistogram(text, "logical_tick_duration_seconds", "Time spent computing one tick.", &metrics.tick_duration);
+	appendHistogram(text, "logical_frame_duration_seconds", "Time from the start of one frame to the start of the next.", &metrics.frame_duration);
+	appendHistogram(text, "logical_input_latency_seconds", "Time from an input event to the present of the first frame showing it.", &metrics.input_latency);
+}
+
+// written next to the target and renamed, so a collector never sees half a file
+static void writeMetricsFile() {
+	string text;
+	formatMetrics(&text);
+	string temporary = string(file_path) + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "w");
+	if (file == NULL) {
+		SDL_Log("Opening %s for writing failed", temporary.c_str());
+		return;
+	}
+	bool failed = fwrite(text.data(), 1, text.size(), file) != text.size();
+	failed = fclose(file) != 0 || failed;
+#if defined(_WIN32)
+	failed = failed || !MoveFileExA(temporary.c_str(), file_path, MOVEFILE_REPLACE_EXISTING);
+#else
+	failed = failed || rename(temporary.c_str(), file_path) != 0;
+#endif
+	if (failed) {
+		SDL_Log("Writing metrics to %s failed", file_path);
+	}
+}
+
+int startMetricsFile(const char *path, Time interval) {
+	file_path = path;
+	file_interval = interval;
+	next_file_write = getCurrentTime();
+	SDL_Log("Writing metrics to %s", path);
+	return 0;
+}
+
+int startMetricsServer(const char *address) {
+	listener = listenOn(address);
+	if (listener == SOCKET_NONE)
+		return -1;
+	SDL_Log("Serving metrics on %s", address);
+	return 0;
+}
+
+void stopMetrics() {
+	for (size_t i = 0; i < connections.size(); ++i) {
+		closeSocket(connections[i].socket);
+	}
+	connections.clear();
+	closeSocket(listener);
+	listener = SOCKET_NONE;
+	if (file_path != NULL) {
+		// leave the final values behind
+		writeMetricsFile();
+		file_path = NULL;
+	}
+}
+
+// returns false once the connection is done with
+static bool serviceConnection(MetricsConnection *connection, Time now) {
+	if (connection->output.empty()) {
+		char buffer[1024];
+		int received;
+		while ((received = receiveSome(connection->socket, buffer, sizeof(buffer))) > 0) {
+			connection->input.append(buffer, received);
+		}
+		if (received < 0 || connection->input.size() > 8192)
+			return false;
+		// the path does not matter, every request gets the metrics
+		if (connection->input.find("\r\n\r\n") == string::npos)
+			return now - connection->accepted < METRICS_CONNECTION_TIMEOUT;
+		string body;
+		formatMetrics(&body);
+		char head[160];
+		SDL_snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", (int)body.size());
+		connection->output = head + body;
+		connection->sent = 0;
+	}
+	while (connection->sent < connection->output.size()) {
+		int sent = sendSome(connection->socket, connection->output.data() + connection->sent, (int)(connection->output.size() - connection->sent));
+		if (sent < 0)
+			return false;
+		if (sent == 0)
+			return now - connection->accepted < METRICS_CONNECTION_TIMEOUT;
+		connection->sent += sent;
+	}
+	return false;
+}
+
+void pollMetrics() {
+	Time now = getCurrentTime();
+	if (!rate_started || now - rate_start >= seconds(1)) {
+		uint64 ticks = metrics.ticks.load(memory_order_relaxed);
+		if (rate_started) {
+			setMetric(&metrics.ticks_per_second, (int64)((ticks - rate_ticks) * seconds(1) / (now - rate_start)));
+		}
+		rate_started = true;
+		rate_start = now;
+		rate_ticks = ticks;
+	}
+
+	if (file_path != NULL && now >= next_file_write) {
+		writeMetricsFile();
+		next_file_write = now + file_interval;
+	}
+
+	if (listener == SOCKET_NONE)
+		return;
+	while (true) {
+		Socket s = acceptFrom(listener);
+		if (s == SOCKET_NONE)
+			break;
+		connections.push_back(MetricsConnection());
+		connections.back().socket = s;
+		connections.back().accepted = now;
+		connections.back().sent = 0;
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < connections.size(); ++i) {
+		if (serviceConnection(&connections[i], now)) {
+			if (kept != i) {
+				swap(connections[kept], connections[i]);
+			}
+			++kept;
+		} else {
+			closeSocket(connections[i].socket);
+		}
+	}
+	connections.resize(kept);
+}
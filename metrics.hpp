@@ -0,0 +1,72 @@
+#ifndef METRICS_HPP_
+#define METRICS_HPP_
+
+#include "std_types.hpp"
+#include "time.hpp"
+
+#include <atomic>
+#include <string>
+
+// Operational metrics of a running instance, in the Prometheus text format.
+//
+// The game updates them with relaxed atomics from whatever thread it runs on,
+// nothing on the hot path ever waits for the exporter. pollMetrics is called
+// from the main loop and either rewrites a text file now and then, for the
+// node exporter's textfile collector, or answers scrapes on a loopback port.
+
+// upper bounds of the duration buckets in microseconds, the last one is +Inf
+#define METRICS_BUCKETS 12
+
+struct MetricsHistogram {
+	// not cumulative, that is done when they are written out
+	std::atomic<uint64> buckets[METRICS_BUCKETS];
+	std::atomic<uint64> count;
+	// microseconds
+	std::atomic<uint64> sum;
+};
+
+struct Metrics {
+	// counters
+	std::atomic<uint64> balls_allocated;
+	std::atomic<uint64> balls_freed;
+	// addBall calls that found no free ball
+	std::atomic<uint64> ball_allocation_failures;
+	std::atomic<uint64> rotors_destroyed;
+	std::atomic<uint64> ticks;
+	std::atomic<uint64> frames;
+
+	// gauges
+	std::atomic<int64> input_queue_depth;
+	// updated by pollMetrics about once a second
+	std::atomic<int64> ticks_per_second;
+
+	MetricsHistogram tick_duration;
+	MetricsHistogram frame_duration;
+	// from an input event to the present of the first frame that shows it
+	MetricsHistogram input_latency;
+};
+
+extern Metrics metrics;
+
+inline void countMetric(std::atomic<uint64> *counter) {
+	counter->fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void setMetric(std::atomic<int64> *gauge, int64 value) {
+	gauge->store(value, std::memory_order_relaxed);
+}
+
+void observeDuration(MetricsHistogram *, Time duration);
+
+// the current values in the Prometheus text format
+void formatMetrics(std::string *text);
+
+// both may be used at the same time, the file is rewritten every interval
+int startMetricsFile(const char *path, Time interval);
+// address as for listenOn, "tcp:<port>" only listens on the loopback interface
+int startMetricsServer(const char *address);
+void stopMetrics();
+// never blocks
+void pollMetrics();
+
+#endif // METRICS_HPP_
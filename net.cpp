@@ -0,0 +1,221 @@
+#include "net.hpp"
+
+#include <SDL2/SDL.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#pragma comment(lib, "ws2_32.lib")
+	typedef int socklen_t;
+	typedef SOCKET NativeSocket;
+#else
+	#include <arpa/inet.h>
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+	typedef int NativeSocket;
+#endif
+
+static void setNonBlocking(Socket s) {
+#if defined(_WIN32)
+	u_long mode = 1;
+	ioctlsocket((NativeSocket)s, FIONBIO, &mode);
+#else
+	int flags = fcntl((NativeSocket)s, F_GETFL, 0);
+	fcntl((NativeSocket)s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static bool wouldBlock() {
+#if defined(_WIN32)
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static void setNoDelay(Socket s) {
+	int one = 1;
+	setsockopt((NativeSocket)s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+}
+
+int startNet() {
+#if defined(_WIN32)
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		SDL_Log("WSAStartup failed");
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+void stopNet() {
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
+
+// fills in the socket address for the given address string, returns the address family or -1
+static int parseAddress(const char *address, sockaddr_storage *storage, socklen_t *length) {
+	memset(storage, 0, sizeof(*storage));
+	if (strncmp(address, "tcp:", 4) == 0) {
+		sockaddr_in *in = (sockaddr_in *)storage;
+		in->sin_family = AF_INET;
+		in->sin_port = htons((unsigned short)atoi(address + 4));
+		in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		*length = sizeof(*in);
+		return AF_INET;
+	}
+#if !defined(_WIN32)
+	if (strncmp(address, "unix:", 5) == 0) {
+		sockaddr_un *un = (sockaddr_un *)storage;
+		un->sun_family = AF_UNIX;
+		if (strlen(address + 5) >= sizeof(un->sun_path)) {
+			SDL_Log("Socket path too long: %s", address + 5);
+			return -1;
+		}
+		strcpy(un->sun_path, address + 5);
+		*length = sizeof(*un);
+		return AF_UNIX;
+	}
+#endif
+	SDL_Log("Unsupported address: %s", address);
+	return -1;
+}
+
+Socket listenOn(const char *address) {
+	sockaddr_storage storage;
+	socklen_t length;
+	int family = parseAddress(address, &storage, &length);
+	if (family < 0)
+		return SOCKET_NONE;
+
+	Socket s = (Socket)socket(family, SOCK_STREAM, 0);
+	if (s == SOCKET_NONE) {
+		SDL_Log("Creating socket for %s failed", address);
+		return SOCKET_NONE;
+	}
+	if (family == AF_INET) {
+		int one = 1;
+		setsockopt((NativeSocket)s, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+	}
+#if !defined(_WIN32)
+	if (family == AF_UNIX) {
+		// a stale socket file from an earlier run would make bind fail
+		unlink(((sockaddr_un *)&storage)->sun_path);
+	}
+#endif
+	if (bind((NativeSocket)s, (sockaddr *)&storage, length) != 0 || listen((NativeSocket)s, 16) != 0) {
+		SDL_Log("Listening on %s failed", address);
+		closeSocket(s);
+		return SOCKET_NONE;
+	}
+	setNonBlocking(s);
+	return s;
+}
+
+Socket connectTo(const char *address) {
+	sockaddr_storage storage;
+	socklen_t length;
+	int family = parseAddress(address, &storage, &length);
+	if (family < 0)
+		return SOCKET_NONE;
+
+	Socket s = (Socket)socket(family, SOCK_STREAM, 0);
+	if (s == SOCKET_NONE) {
+		SDL_Log("Creating socket for %s failed", address);
+		return SOCKET_NONE;
+	}
+	if (connect((NativeSocket)s, (sockaddr *)&storage, length) != 0) {
+		SDL_Log("Connecting to %s failed", address);
+		closeSocket(s);
+		return SOCKET_NONE;
+	}
+	if (family == AF_INET) {
+		setNoDelay(s);
+	}
+	setNonBlocking(s);
+	return s;
+}
+
+Socket acceptFrom(Socket listener) {
+	Socket s = (Socket)accept((NativeSocket)listener, NULL, NULL);
+	if (s == SOCKET_NONE)
+		return SOCKET_NONE;
+	setNoDelay(s);
+	setNonBlocking(s);
+	return s;
+}
+
+void closeSocket(Socket s) {
+	if (s == SOCKET_NONE)
+		return;
+#if defined(_WIN32)
+	closesocket((NativeSocket)s);
+#else
+	close((NativeSocket)s);
+#endif
+}
+
+int sendSome(Socket s, const void *data, int size) {
+#if defined(_WIN32)
+	int flags = 0;
+#else
+	int flags = MSG_NOSIGNAL;
+#endif
+	int sent = (int)send((NativeSocket)s, (const char *)data, size, flags);
+	if (sent < 0) {
+		return wouldBlock() ? 0 : -1;
+	}
+	return sent;
+}
+
+int receiveSome(Socket s, void *data, int size) {
+	int received = (int)recv((NativeSocket)s, (char *)data, size, 0);
+	if (received < 0) {
+		return wouldBlock() ? 0 : -1;
+	} else if (received == 0) {
+		// orderly shutdown by the other side
+		return -1;
+	}
+	return received;
+}
+
+void waitForSockets(const Socket *sockets, int count, Time timeout) {
+	int timeout_ms = (int)(timeout / millis(1));
+	if (timeout_ms < 0)
+		timeout_ms = 0;
+#if defined(_WIN32)
+	fd_set readable;
+	FD_ZERO(&readable);
+	for (int i = 0; i < count; ++i) {
+		FD_SET((NativeSocket)sockets[i], &readable);
+	}
+	timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = timeout_ms % 1000 * 1000;
+	if (count == 0) {
+		Sleep(timeout_ms);
+		return;
+	}
+	select(0, &readable, NULL, NULL, &tv);
+#else
+	std::vector<pollfd> fds(count);
+	for (int i = 0; i < count; ++i) {
+		fds[i].fd = (NativeSocket)sockets[i];
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	poll(fds.data(), count, timeout_ms);
+#endif
+}
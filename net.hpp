@@ -0,0 +1,32 @@
+#ifndef NET_HPP_
+#define NET_HPP_
+
+#include "std_types.hpp"
+#include "time.hpp"
+
+// Thin non-blocking socket layer for local connections. Addresses are either
+// "unix:<path>" for a Unix domain socket or "tcp:<port>" for the loopback
+// interface.
+
+typedef intptr_t Socket;
+
+#define SOCKET_NONE ((Socket)-1)
+
+int startNet();
+void stopNet();
+
+Socket listenOn(const char *address);
+Socket connectTo(const char *address);
+// returns SOCKET_NONE if nobody is waiting
+Socket acceptFrom(Socket listener);
+void closeSocket(Socket);
+
+// both return the number of bytes transferred, 0 if the call would block and
+// -1 if the connection is gone
+int sendSome(Socket, const void *data, int size);
+int receiveSome(Socket, void *data, int size);
+
+// wait until one of the sockets is readable or the timeout has passed
+void waitForSockets(const Socket *sockets, int count, Time timeout);
+
+#endif // NET_HPP_
@@ -0,0 +1,384 @@
+#include "logical.hpp"
+
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Packed game states only hold what changes while playing: balls, destroyed
+// rotors, time and the random number generator. The map itself (lines, rotors,
+// inserters, spawns) is not stored, so a snapshot can only be unpacked into a
+// GameData that has the same map built already. Rotor occupancy and the line
+// queues are not stored either, they follow from the connectors of the balls.
+//
+// All padding is zeroed, so two snapshots of the same state are byte-identical
+// and can be hashed and compared as plain memory.
+
+#define PACKED_INDEX_NONE 0xFFFF
+// for rotors and spawns, balls get 32 bits
+#define PACKED_INDEX_MAX  0xFFFE
+
+static_assert(sizeof(PackedGameHeader) == 48, "PackedGameHeader must not contain padding");
+static_assert(sizeof(PackedBall) == 16, "PackedBall must not contain padding");
+static_assert(sizeof(PackedBallMovingFixed) == sizeof(PackedBallMoving), "fixed-point records must have the same size");
+static_assert(sizeof(PackedBallFreeFixed) == sizeof(PackedBallFree), "fixed-point records must have the same size");
+
+static int destroyedBitsSize(int rotor_count) {
+	return (rotor_count + 31) / 32 * 4;
+}
+
+static int packedBallSize(const Ball *ball) {
+	if (ball->connector.type == CONNECTOR_LINE) {
+		return sizeof(PackedBall) + sizeof(PackedBallMoving);
+	} else if (ball->connector.type == CONNECTOR_FREE) {
+		return sizeof(PackedBall) + sizeof(PackedBallFree);
+	} else {
+		return sizeof(PackedBall);
+	}
+}
+
+static uint32 packConnector(const Connector *connector) {
+	uint32 position = 0;
+	if (connector->type == CONNECTOR_ROTOR) {
+		position = connector->rotor.position;
+	}
+	uint32 target = (uint32)(connector->target + 1);
+	return (uint32)connector->type | (position << 3) | (target << 5);
+}
+
+static void unpackConnector(uint32 packed, Connector *connector) {
+	connector->type = packed & 0x7;
+	connector->target = (int)(packed >> 5) - 1;
+	if (connector->type == CONNECTOR_ROTOR) {
+		connector->rotor.position = (packed >> 3) & 0x3;
+	}
+}
+
+static int16 quantizePosition(float value) {
+	// far off the map, which no ball in a rotor or at a wall is
+	if (value >= -32768.0f && value <= 32767.0f) {
+		return (int16)value;
+	} else {
+		return 0;
+	}
+}
+
+int packedGameSize(const GameData *gd) {
+	int size = sizeof(PackedGameHeader) + destroyedBitsSize(gd->rotor_count);
+	for (int i = 0; i < NBALLS; ++i) {
+		if (gd->balls[i].type != BALL_TYPE_NONE) {
+			size += packedBallSize(&gd->balls[i]);
+		}
+	}
+	return size;
+}
+
+int packGame(const GameData *gd, void *buffer, int capacity) {
+	int size = packedGameSize(gd);
+	if (size > capacity) {
+		SDL_Log("Packing game failed, %d bytes needed but only %d available", size, capacity);
+		return -1;
+	}
+	if (gd->rotor_count > PACKED_INDEX_MAX || gd->line_count > (1 << 26)) {
+		SDL_Log("Packing game failed, map is too large");
+		return -1;
+	}
+
+	byte *out = (byte *)buffer;
+
+	PackedGameHeader header;
+	memset(&header, 0, sizeof(header));
+	header.time = gd->time;
+	header.random = gd->random;
+	header.size = size;
+	header.rotor_count = gd->rotor_count;
+	header.ball_type_count = gd->ball_type_count;
+	header.ball_type_index_next = gd->ball_type_index_next;
+	header.fixed_point = gd->fixed_point;
+	header.line_spacing = gd->line_spacing;
+	for (int i = 0; i < gd->ball_type_count; ++i) {
+		header.ball_types[i] = gd->ball_types[i];
+	}
+	byte *header_out = out;
+	out += sizeof(header);
+
+	// destroyed rotors
+	int bits_size = destroyedBitsSize(gd->rotor_count);
+	memset(out, 0, bits_size);
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		if (gd->rotors[i].destroyed) {
+			out[i / 8] |= 1 << (i % 8);
+		}
+	}
+	out += bits_size;
+
+	// balls
+	int ball_count = 0;
+	for (int i = 0; i < NBALLS; ++i) {
+		const Ball *ball = &gd->balls[i];
+		if (ball->type == BALL_TYPE_NONE)
+			continue;
+
+		PackedBall packed;
+		memset(&packed, 0, sizeof(packed));
+		packed.index = i;
+		packed.spawn_index = ball->spawn_index >= 0 ? ball->spawn_index : PACKED_INDEX_NONE;
+		packed.connector = packConnector(&ball->connector);
+		packed.type = ball->type;
+		packed.released_counter = ball->released_counter < 255 ? ball->released_counter : 255;
+		// balls in spawns and inserters have no position, only what the slot held before
+		if (ball->connector.type == CONNECTOR_ROTOR || ball->connector.type == CONNECTOR_WALL) {
+			float x, y;
+			getBallPosition(gd, i, &x, &y);
+			packed.x = quantizePosition(x);
+			packed.y = quantizePosition(y);
+		}
+		memcpy(out, &packed, sizeof(packed));
+		out += sizeof(packed);
+
+		Time age = gd->time - ball->created;
+		if (ball->connector.type == CONNECTOR_LINE && gd->fixed_point) {
+			PackedBallMovingFixed moving;
+			moving.line_progress = ball->line_progress;
+			moving.reserved = 0;
+			memcpy(out, &moving, sizeof(moving));
+			out += sizeof(moving);
+		} else if (ball->connector.type == CONNECTOR_LINE) {
+			PackedBallMoving moving;
+			moving.x = ball->x;
+			moving.y = ball->y;
+			memcpy(out, &moving, sizeof(moving));
+			out += sizeof(moving);
+		} else if (ball->connector.type == CONNECTOR_FREE && gd->fixed_point) {
+			PackedBallFreeFixed free_ball;
+			free_ball.x = ball->fixed_x;
+			free_ball.y = ball->fixed_y;
+			free_ball.vx = ball->fixed_vx;
+			free_ball.vy = ball->fixed_vy;
+			free_ball.age = age < INT32_MAX ? (int32)age : INT32_MAX;
+			memcpy(out, &free_ball, sizeof(free_ball));
+			out += sizeof(free_ball);
+		} else if (ball->connector.type == CONNECTOR_FREE) {
+			PackedBallFree free_ball;
+			free_ball.x = ball->x;
+			free_ball.y = ball->y;
+			free_ball.vx = ball->vx;
+			free_ball.vy = ball->vy;
+			free_ball.age = age < INT32_MAX ? (int32)age : INT32_MAX;
+			memcpy(out, &free_ball, sizeof(free_ball));
+			out += sizeof(free_ball);
+		}
+		++ball_count;
+	}
+
+	header.ball_count = ball_count;
+	memcpy(header_out, &header, sizeof(header));
+
+	SDL_assert(out - (byte *)buffer == size);
+	return size;
+}
+
+static bool checkConnector(const GameData *gd, const Connector *connector) {
+	switch (connector->type) {
+	case CONNECTOR_LINE:
+		return connector->target >= 0 && connector->target < gd->line_count;
+	case CONNECTOR_ROTOR:
+		return connector->target >= 0 && connector->target < gd->rotor_count;
+	case CONNECTOR_SPAWN:
+		return connector->target >= 0 && connector->target < gd->spawn_count;
+	case CONNECTOR_INSERTER:
+		return connector->target >= 0 && connector->target < gd->inserter_count;
+	case CONNECTOR_FREE:
+		return true;
+	default:
+		// no ball is ever parked on a wall
+		return false;
+	}
+}
+
+// Snapshots may come from the network, so everything unpackGame relies on is
+// checked here first, without touching the game.
+static bool checkPackedGame(const GameData *gd, const PackedGameHeader *header, const byte *in, const byte *end) {
+	if (header->ball_type_count < 1 || header->ball_type_count > NUM_BALL_TYPES)
+		return false;
+	for (int i = 0; i < header->ball_type_count; ++i) {
+		if (header->ball_types[i] < 0 || header->ball_types[i] >= NUM_BALL_TYPES)
+			return false;
+	}
+	if (end - in < destroyedBitsSize(gd->rotor_count))
+		return false;
+	in += destroyedBitsSize(gd->rotor_count);
+
+	// rotor positions taken so far, two balls must not share one
+	vector<bool> taken(gd->rotor_count * 4);
+	int last_index = -1;
+	for (uint32 n = 0; n < header->ball_count; ++n) {
+		PackedBall packed;
+		if (end - in < (int)sizeof(packed))
+			return false;
+		memcpy(&packed, in, sizeof(packed));
+		in += sizeof(packed);
+
+		// packGame writes balls in the order of their index
+		if (packed.index >= NBALLS || (int)packed.index <= last_index)
+			return false;
+		last_index = packed.index;
+		if (packed.type < 0 || packed.type >= NUM_BALL_TYPES)
+			return false;
+		if (packed.spawn_index != PACKED_INDEX_NONE && packed.spawn_index >= gd->spawn_count)
+			return false;
+
+		Connector connector;
+		memset(&connector, 0, sizeof(connector));
+		unpackConnector(packed.connector, &connector);
+		if (!checkConnector(gd, &connector))
+			return false;
+		int record_size = 0;
+		if (connector.type == CONNECTOR_LINE) {
+			record_size = sizeof(PackedBallMoving);
+		} else if (connector.type == CONNECTOR_FREE) {
+			record_size = sizeof(PackedBallFree);
+		} else if (connector.type == CONNECTOR_ROTOR) {
+			int slot = connector.target * 4 + connector.rotor.position;
+			if (taken[slot])
+				return false;
+			taken[slot] = true;
+		}
+		if (end - in < record_size)
+			return false;
+		in += record_size;
+	}
+	return in == end;
+}
+
+int unpackGame(GameData *gd, const void *buffer, int size) {
+	const byte *in = (const byte *)buffer;
+	const byte *end = in + size;
+
+	PackedGameHeader header;
+	if (size < (int)sizeof(header)) {
+		SDL_Log("Unpacking game failed, snapshot is truncated");
+		return -1;
+	}
+	memcpy(&header, in, sizeof(header));
+	in += sizeof(header);
+	if ((int)header.size != size || header.rotor_count != gd->rotor_count) {
+		SDL_Log("Unpacking game failed, snapshot does not match the map");
+		return -1;
+	}
+	if (!checkPackedGame(gd, &header, in, end)) {
+		SDL_Log("Unpacking game failed, snapshot is damaged");
+		return -1;
+	}
+
+	gd->time = header.time;
+	gd->random = header.random;
+	gd->ball_type_count = header.ball_type_count;
+	gd->ball_type_index_next = header.ball_type_index_next;
+	gd->fixed_point = header.fixed_point != 0;
+	gd->line_spacing = header.line_spacing != 0;
+	for (int i = 0; i < header.ball_type_count; ++i) {
+		gd->ball_types[i] = header.ball_types[i];
+	}
+
+	// destroyed rotors, occupancy is filled in from the balls below
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		gd->rotors[i].destroyed = (in[i / 8] >> (i % 8)) & 1;
+		for (int pos = 0; pos < 4; ++pos) {
+			gd->rotors[i].balls[pos] = -1;
+		}
+		gd->rotors[i].slots = 0;
+	}
+	in += destroyedBitsSize(gd->rotor_count);
+
+	for (int i = 0; i < NBALLS; ++i) {
+		gd->balls[i].type = BALL_TYPE_NONE;
+	}
+	gd->ball_end = 0;
+
+	for (uint32 n = 0; n < header.ball_count; ++n) {
+		PackedBall packed;
+		memcpy(&packed, in, sizeof(packed));
+		in += sizeof(packed);
+
+		Ball *ball = &gd->balls[packed.index];
+		gd->ball_end = SDL_max(gd->ball_end, (int)packed.index + 1);
+		ball->type = packed.type;
+		ball->spawn_index = packed.spawn_index != PACKED_INDEX_NONE ? packed.spawn_index : -1;
+		ball->released_counter = packed.released_counter;
+		ball->created = gd->time;
+		ball->x = packed.x;
+		ball->y = packed.y;
+		ball->vx = 0;
+		ball->vy = 0;
+		unpackConnector(packed.connector, &ball->connector);
+
+		if (ball->connector.type == CONNECTOR_LINE && gd->fixed_point) {
+			PackedBallMovingFixed moving;
+			memcpy(&moving, in, sizeof(moving));
+			in += sizeof(moving);
+			// the position follows from the distance along the line
+			const Line *line = &gd->lines[ball->connector.target];
+			ball->line_progress = moving.line_progress;
+			ball->fixed_x = line->fixed_x1 + (int32)(((int64)line->fixed_dir_x * moving.line_progress) >> FIXED_DIR_SHIFT);
+			ball->fixed_y = line->fixed_y1 + (int32)(((int64)line->fixed_dir_y * moving.line_progress) >> FIXED_DIR_SHIFT);
+			ball->x = fromFixed(ball->fixed_x);
+			ball->y = fromFixed(ball->fixed_y);
+		} else if (ball->connector.type == CONNECTOR_LINE) {
+			PackedBallMoving moving;
+			memcpy(&moving, in, sizeof(moving));
+			in += sizeof(moving);
+			ball->x = moving.x;
+			ball->y = moving.y;
+		} else if (ball->connector.type == CONNECTOR_FREE && gd->fixed_point) {
+			PackedBallFreeFixed free_ball;
+			memcpy(&free_ball, in, sizeof(free_ball));
+			in += sizeof(free_ball);
+			ball->fixed_x = free_ball.x;
+			ball->fixed_y = free_ball.y;
+			ball->fixed_vx = free_ball.vx;
+			ball->fixed_vy = free_ball.vy;
+			ball->x = fromFixed(free_ball.x);
+			ball->y = fromFixed(free_ball.y);
+			ball->vx = fromFixed(free_ball.vx);
+			ball->vy = fromFixed(free_ball.vy);
+			ball->created = gd->time - free_ball.age;
+		} else if (ball->connector.type == CONNECTOR_FREE) {
+			PackedBallFree free_ball;
+			memcpy(&free_ball, in, sizeof(free_ball));
+			in += sizeof(free_ball);
+			ball->x = free_ball.x;
+			ball->y = free_ball.y;
+			ball->vx = free_ball.vx;
+			ball->vy = free_ball.vy;
+			ball->created = gd->time - free_ball.age;
+		} else if (ball->connector.type == CONNECTOR_ROTOR) {
+			setRotorBall(gd, ball->connector.target, ball->connector.rotor.position, packed.index);
+		}
+	}
+	rebuildLineQueues(gd);
+	rebuildBallBuckets(gd);
+
+	SDL_assert(in == end);
+	return 0;
+}
+
+uint64 hashPackedGame(const void *buffer, int size) {
+	// FNV-1a over 32 bit words, snapshots are always a multiple of 4 bytes long
+	const byte *in = (const byte *)buffer;
+	uint64 hash = 14695981039346656037ULL;
+	for (int i = 0; i + 4 <= size; i += 4) {
+		uint32 word;
+		memcpy(&word, in + i, sizeof(word));
+		hash ^= word;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+int comparePackedGames(const void *buffer_1, int size_1, const void *buffer_2, int size_2) {
+	if (size_1 != size_2) {
+		return size_1 < size_2 ? -1 : 1;
+	}
+	return memcmp(buffer_1, buffer_2, size_1);
+}
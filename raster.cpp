@@ -0,0 +1,194 @@
+#include "logical.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(LOGICAL_SSE2)
+	#include <emmintrin.h>
+#endif
+
+// Software rasteriser for pixel observations: draws the scene of graphics.cpp
+// (lines, rotor boxes, ball squares, rotor centers) into memory, without SDL.
+// The map is fitted into the image, so any resolution shows the whole board.
+// Everything is made of horizontal spans of one color, which are filled four
+// pixels per store with SSE2 where the compiler has it.
+//
+// Pixels are 4 bytes, red, green, blue and alpha in that order, rows from
+// top to bottom without padding between them.
+
+struct RasterImage {
+	uint32 *pixels;
+	int width;
+	int height;
+	// world to pixels
+	float scale;
+	float offset_x;
+	float offset_y;
+};
+
+struct RasterJob {
+	const GameData *games;
+	byte *pixels;
+	int width;
+	int height;
+};
+
+static uint32 packColor(Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
+	// the byte order in memory matters, not the value
+	Uint8 bytes[4] = { r, g, b, a };
+	uint32 color;
+	memcpy(&color, bytes, sizeof(color));
+	return color;
+}
+
+static void fillSpan(uint32 *row, int x1, int x2, uint32 color) {
+	int x = x1;
+#if defined(LOGICAL_SSE2)
+	__m128i colors = _mm_set1_epi32((int)color);
+	for (; x + 4 <= x2; x += 4) {
+		_mm_storeu_si128((__m128i *)(row + x), colors);
+	}
+#endif
+	for (; x < x2; ++x) {
+		row[x] = color;
+	}
+}
+
+// x2 and y2 are exclusive, the rectangle gets clipped to the image
+static void fillRect(RasterImage *image, int x1, int y1, int x2, int y2, uint32 color) {
+	x1 = SDL_max(x1, 0);
+	y1 = SDL_max(y1, 0);
+	x2 = SDL_min(x2, image->width);
+	y2 = SDL_min(y2, image->height);
+	for (int y = y1; y < y2; ++y) {
+		fillSpan(image->pixels + y * image->width, x1, x2, color);
+	}
+}
+
+// like SDL_RenderFillRect and then SDL_RenderDrawRect on top
+static void drawBox(RasterImage *image, int x1, int y1, int x2, int y2, uint32 fill, uint32 outline) {
+	fillRect(image, x1, y1, x2, y2, outline);
+	fillRect(image, x1 + 1, y1 + 1, x2 - 1, y2 - 1, fill);
+}
+
+static void drawLine(RasterImage *image, int x1, int y1, int x2, int y2, uint32 color) {
+	// Bresenham, clipped per pixel, lines are short at the sizes this is for
+	int dx = SDL_abs(x2 - x1);
+	int dy = -SDL_abs(y2 - y1);
+	int step_x = x1 < x2 ? 1 : -1;
+	int step_y = y1 < y2 ? 1 : -1;
+	int error = dx + dy;
+	while (true) {
+		if (x1 >= 0 && x1 < image->width && y1 >= 0 && y1 < image->height) {
+			image->pixels[y1 * image->width + x1] = color;
+		}
+		if (x1 == x2 && y1 == y2)
+			break;
+		int error2 = 2 * error;
+		if (error2 >= dy) {
+			error += dy;
+			x1 += step_x;
+		}
+		if (error2 <= dx) {
+			error += dx;
+			y1 += step_y;
+		}
+	}
+}
+
+// the pixel rectangle of a square of the given half size around a world point
+static void getSquare(const RasterImage *image, float x, float y, float half_size, int *x1, int *y1, int *x2, int *y2) {
+	int size = SDL_max((int)(2 * half_size * image->scale), 1);
+	*x1 = (int)floorf((x - half_size) * image->scale + image->offset_x);
+	*y1 = (int)floorf((y - half_size) * image->scale + image->offset_y);
+	*x2 = *x1 + size;
+	*y2 = *y1 + size;
+}
+
+// the whole map centered in the image, as large as it fits
+static void fitMap(const GameData *gd, RasterImage *image) {
+	float min_x = 0, min_y = 0, max_x = 1, max_y = 1;
+	bool first = true;
+	for (int i = 0; i < gd->line_count; ++i) {
+		const Line *line = &gd->lines[i];
+		float x1 = SDL_min(line->x1, line->x2), x2 = SDL_max(line->x1, line->x2);
+		float y1 = SDL_min(line->y1, line->y2), y2 = SDL_max(line->y1, line->y2);
+		min_x = first ? x1 : SDL_min(min_x, x1);
+		min_y = first ? y1 : SDL_min(min_y, y1);
+		max_x = first ? x2 : SDL_max(max_x, x2);
+		max_y = first ? y2 : SDL_max(max_y, y2);
+		first = false;
+	}
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		const Rotor *rotor = &gd->rotors[i];
+		min_x = first ? rotor->x - 30 : SDL_min(min_x, rotor->x - 30);
+		min_y = first ? rotor->y - 30 : SDL_min(min_y, rotor->y - 30);
+		max_x = first ? rotor->x + 30 : SDL_max(max_x, rotor->x + 30);
+		max_y = first ? rotor->y + 30 : SDL_max(max_y, rotor->y + 30);
+		first = false;
+	}
+	float map_width = SDL_max(max_x - min_x, 1.0f);
+	float map_height = SDL_max(max_y - min_y, 1.0f);
+	image->scale = SDL_min(image->width / map_width, image->height / map_height);
+	image->offset_x = (image->width - map_width * image->scale) / 2 - min_x * image->scale;
+	image->offset_y = (image->height - map_height * image->scale) / 2 - min_y * image->scale;
+}
+
+void rasterizeGame(const GameData *gd, byte *pixels, int width, int height) {
+	RasterImage image;
+	image.pixels = (uint32 *)pixels;
+	image.width = width;
+	image.height = height;
+	fitMap(gd, &image);
+
+	uint32 black = packColor(0, 0, 0, SDL_ALPHA_OPAQUE);
+	uint32 white = packColor(0xFF, 0xFF, 0xFF, SDL_ALPHA_OPAQUE);
+	uint32 rotor_color = packColor(0xCC, 0xCC, 0xCC, SDL_ALPHA_OPAQUE);
+	uint32 destroyed_color = packColor(0x66, 0x66, 0x66, SDL_ALPHA_OPAQUE);
+	uint32 ball_colors[BALL_TYPE_WHITE + 2];
+	for (int i = 0; i < BALL_TYPE_WHITE + 2; ++i) {
+		ball_colors[i] = packColor(BALL_COLORS[i][0], BALL_COLORS[i][1], BALL_COLORS[i][2], BALL_COLORS[i][3]);
+	}
+
+	fillRect(&image, 0, 0, width, height, black);
+	for (int i = 0; i < gd->line_count; ++i) {
+		const Line *line = &gd->lines[i];
+		drawLine(&image,
+			(int)(line->x1 * image.scale + image.offset_x), (int)(line->y1 * image.scale + image.offset_y),
+			(int)(line->x2 * image.scale + image.offset_x), (int)(line->y2 * image.scale + image.offset_y), white);
+	}
+	int x1, y1, x2, y2;
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		getSquare(&image, gd->rotors[i].x, gd->rotors[i].y, 30, &x1, &y1, &x2, &y2);
+		drawBox(&image, x1, y1, x2, y2, gd->rotors[i].destroyed ? destroyed_color : rotor_color, white);
+	}
+	for (int i = 0; i < gd->ball_end; ++i) {
+		const Ball *ball = &gd->balls[i];
+		if (ball->type == BALL_TYPE_NONE)
+			continue;
+		float x, y;
+		getBallPosition(gd, i, &x, &y);
+		getSquare(&image, x, y, 10, &x1, &y1, &x2, &y2);
+		fillRect(&image, x1, y1, x2, y2, ball_colors[ball->type + 1]);
+	}
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		getSquare(&image, gd->rotors[i].x, gd->rotors[i].y, 10, &x1, &y1, &x2, &y2);
+		drawBox(&image, x1, y1, x2, y2, gd->rotors[i].destroyed ? destroyed_color : rotor_color, white);
+	}
+}
+
+static void rasterizeTask(void *context, int game_index) {
+	RasterJob *job = (RasterJob *)context;
+	byte *pixels = job->pixels + (size_t)game_index * job->width * job->height * 4;
+	rasterizeGame(&job->games[game_index], pixels, job->width, job->height);
+}
+
+// one image after the other, the games are spread over the worker threads
+void rasterizeGames(const GameData *games, int game_count, byte *pixels, int width, int height) {
+	RasterJob job;
+	job.games = games;
+	job.pixels = pixels;
+	job.width = width;
+	job.height = height;
+	runOnWorkers(game_count, rasterizeTask, &job);
+}
@@ -0,0 +1,251 @@
+#include "logical.hpp"
+
+#include <cmath>
+
+// Reference engine for the lockstep checker, see lockstep.cpp.
+//
+// A frozen copy of the straightforward tick: progressLogic, changeBallConnector
+// and everything they call, as it was before anyone started optimising it.
+// Do not optimise or otherwise change this file, the whole point is that it
+// stays the same while game.cpp and tick.cpp do not. It only leaves out the
+// logging and the metrics, and it never reads or writes balls[-1].
+
+static const int REFERENCE_LINE_VELOCITY = 160;
+
+static int referenceAddBall(GameData *gd, int type) {
+	int ball_index = 0;
+	while (ball_index < NBALLS && gd->balls[ball_index].type != BALL_TYPE_NONE) {
+		++ball_index;
+	}
+	if (ball_index == NBALLS)
+		return -1;
+	gd->balls[ball_index].type = type;
+	gd->balls[ball_index].created = gd->time;
+	gd->balls[ball_index].released_counter = 0;
+	gd->balls[ball_index].spawn_index = -1;
+	gd->balls[ball_index].has_prev = false;
+	gd->ball_last_added = ball_index;
+	return ball_index;
+}
+
+static int referencePlaceBallInSpawn(GameData *gd, int ball_type, int spawn_index) {
+	int ball_index = referenceAddBall(gd, ball_type);
+	if (ball_index >= 0) {
+		gd->balls[ball_index].connector.type = CONNECTOR_SPAWN;
+		gd->balls[ball_index].connector.target = spawn_index;
+	}
+	return ball_index;
+}
+
+static void referencePlaceRandomBallInSpawn(GameData *gd, int spawn_index) {
+	int i = random_get(&gd->random);
+	int type = gd->ball_types[i % gd->ball_type_count];
+	referencePlaceBallInSpawn(gd, type, spawn_index);
+}
+
+static void referenceCopyConnector(const Connector *src, Connector *dst) {
+	dst->type = src->type;
+	dst->target = src->target;
+	if (src->type == CONNECTOR_ROTOR) {
+		dst->rotor.position = src->rotor.position;
+	}
+}
+
+static void referenceRotorOffset(int position, float *dx, float *dy) {
+	*dx = 0;
+	*dy = 0;
+	if (position == ROTOR_POSITION_RIGHT) {
+		*dx = +15.0;
+	} else if (position == ROTOR_POSITION_TOP) {
+		*dy = -15.0;
+	} else if (position == ROTOR_POSITION_LEFT) {
+		*dx = -15.0;
+	} else if (position == ROTOR_POSITION_BOTTOM) {
+		*dy = +15.0;
+	}
+}
+
+static void referenceChangeBallConnector(GameData *gd, int ball_index, const Connector *connector) {
+	Ball *ball = &gd->balls[ball_index];
+	referenceCopyConnector(connector, &ball->connector);
+	if (connector->type == CONNECTOR_LINE) {
+		const Line *line = &gd->lines[connector->target];
+		ball->x = line->x1;
+		ball->y = line->y1;
+		ball->fixed_x = line->fixed_x1;
+		ball->fixed_y = line->fixed_y1;
+		ball->line_progress = 0;
+	} else if (connector->type == CONNECTOR_ROTOR) {
+		int rotor_index = ball->connector.target;
+		int position = ball->connector.rotor.position;
+		Rotor *rotor = &gd->rotors[rotor_index];
+		float dx, dy;
+		referenceRotorOffset(position, &dx, &dy);
+		ball->x = rotor->x + dx;
+		ball->y = rotor->y + dy;
+		rotor->balls[position] = ball_index;
+
+		if (ball->released_counter == 0) {
+			referencePlaceRandomBallInSpawn(gd, ball->spawn_index);
+		}
+
+		// four balls of the same type destroy the rotor, an empty position never matches
+		bool all_identical = true;
+		for (int i = 0; i < 4; ++i) {
+			if (rotor->balls[i] == -1 || gd->balls[rotor->balls[i]].type != gd->balls[rotor->balls[0]].type) {
+				all_identical = false;
+				break;
+			}
+		}
+		if (all_identical) {
+			for (int i = 0; i < 4; ++i) {
+				gd->balls[rotor->balls[i]].type = BALL_TYPE_NONE;
+				rotor->balls[i] = -1;
+			}
+			rotor->destroyed = true;
+		}
+	}
+}
+
+static bool referenceMoveBallAlongLine(GameData *gd, int ball_index, Time t) {
+	Ball *ball = &gd->balls[ball_index];
+	const Line *line = &gd->lines[ball->connector.target];
+	if (gd->fixed_point) {
+		int64 progress = ball->line_progress + (int64)REFERENCE_LINE_VELOCITY * t * (1 << FIXED_SHIFT) / seconds(1);
+		if (progress > line->fixed_length)
+			return true;
+		ball->line_progress = (int32)progress;
+		ball->fixed_x = line->fixed_x1 + (int32)((line->fixed_dir_x * progress) >> FIXED_DIR_SHIFT);
+		ball->fixed_y = line->fixed_y1 + (int32)((line->fixed_dir_y * progress) >> FIXED_DIR_SHIFT);
+		ball->x = fromFixed(ball->fixed_x);
+		ball->y = fromFixed(ball->fixed_y);
+		return false;
+	}
+	float line_x = line->x2 - line->x1;
+	float line_y = line->y2 - line->y1;
+	float line_norm = sqrt(line_x * line_x + line_y * line_y);
+	float dir_x = line_x / line_norm;
+	float dir_y = line_y / line_norm;
+	float ball_x = ball->x - line->x1;
+	float ball_y = ball->y - line->y1;
+	float proj = ball_x * dir_x + ball_y * dir_y;
+	float dt = t / (float)seconds(1);
+	float velocity = (float)REFERENCE_LINE_VELOCITY;
+	float new_proj = proj + velocity * dt;
+	if (new_proj > line_norm)
+		return true;
+	ball->x = line->x1 + dir_x * new_proj;
+	ball->y = line->y1 + dir_y * new_proj;
+	return false;
+}
+
+// for inserters and the ends of lines that lead into a rotor
+static void referenceInsert(GameData *gd, int ball_index, const Connector *connector_success, const Connector *connector_failure) {
+	if (connector_success->type == CONNECTOR_ROTOR && gd->rotors[connector_success->target].balls[connector_success->rotor.position] != -1) {
+		referenceChangeBallConnector(gd, ball_index, connector_failure);
+	} else {
+		referenceChangeBallConnector(gd, ball_index, connector_success);
+	}
+}
+
+static void referenceProgressBall(GameData *gd, int ball_index, Time t) {
+	Ball *ball = &gd->balls[ball_index];
+	while (ball->type != BALL_TYPE_NONE) {
+		int connector_type = ball->connector.type;
+		if (connector_type == CONNECTOR_SPAWN) {
+			int spawn_index = ball->connector.target;
+			ball->spawn_index = spawn_index;
+			referenceChangeBallConnector(gd, ball_index, &gd->spawns[spawn_index].connector);
+		} else if (connector_type == CONNECTOR_INSERTER) {
+			const Inserter *inserter = &gd->inserters[ball->connector.target];
+			referenceInsert(gd, ball_index, &inserter->connector_success, &inserter->connector_failure);
+		} else if (connector_type == CONNECTOR_LINE) {
+			if (referenceMoveBallAlongLine(gd, ball_index, t)) {
+				const Connector *connector = &gd->lines[ball->connector.target].connector;
+				const Connector *connector_failure = connector;
+				if (connector->type == CONNECTOR_ROTOR) {
+					connector_failure = &gd->rotors[connector->target].connectors[connector->rotor.position];
+				}
+				referenceInsert(gd, ball_index, connector, connector_failure);
+			}
+			break;
+		} else if (connector_type == CONNECTOR_FREE) {
+			if (gd->fixed_point) {
+				ball->fixed_x += ball->fixed_vx;
+				ball->fixed_y += ball->fixed_vy;
+				ball->x = fromFixed(ball->fixed_x);
+				ball->y = fromFixed(ball->fixed_y);
+			} else {
+				ball->x += ball->vx;
+				ball->y += ball->vy;
+			}
+			if (gd->time - ball->created > seconds(20)) {
+				ball->type = BALL_TYPE_NONE;
+			}
+			break;
+		} else {
+			// balls in rotors do nothing, neither do balls stuck at a wall
+			break;
+		}
+	}
+}
+
+void progressLogicReference(GameData *gd, Time t) {
+	for (int i = 0; i < NBALLS; ++i) {
+		referenceProgressBall(gd, i, t);
+	}
+	gd->time += t;
+}
+
+static void referenceTurnRotor(GameData *gd, int rotor_index, int direction) {
+	int *balls = gd->rotors[rotor_index].balls;
+	int temp = balls[ROTOR_POSITION_RIGHT];
+	if (direction == ROTOR_CLOCKWISE) {
+		balls[ROTOR_POSITION_RIGHT] = balls[ROTOR_POSITION_TOP];
+		balls[ROTOR_POSITION_TOP] = balls[ROTOR_POSITION_LEFT];
+		balls[ROTOR_POSITION_LEFT] = balls[ROTOR_POSITION_BOTTOM];
+		balls[ROTOR_POSITION_BOTTOM] = temp;
+	} else {
+		balls[ROTOR_POSITION_RIGHT] = balls[ROTOR_POSITION_BOTTOM];
+		balls[ROTOR_POSITION_BOTTOM] = balls[ROTOR_POSITION_LEFT];
+		balls[ROTOR_POSITION_LEFT] = balls[ROTOR_POSITION_TOP];
+		balls[ROTOR_POSITION_TOP] = temp;
+	}
+	for (int position = 0; position < 4; ++position) {
+		int ball_index = balls[position];
+		if (ball_index >= 0) {
+			Ball *ball = &gd->balls[ball_index];
+			ball->connector.rotor.position = position;
+			float dx, dy;
+			referenceRotorOffset(position, &dx, &dy);
+			ball->x = gd->rotors[rotor_index].x + dx;
+			ball->y = gd->rotors[rotor_index].y + dy;
+		}
+	}
+}
+
+static void referenceReleaseBall(GameData *gd, int rotor_index, int position) {
+	Rotor *rotor = &gd->rotors[rotor_index];
+	int ball_index = rotor->balls[position];
+	if (ball_index >= 0 && rotor->connectors[position].type != CONNECTOR_WALL) {
+		referenceChangeBallConnector(gd, ball_index, &rotor->connectors[position]);
+		gd->balls[ball_index].released_counter++;
+		rotor->balls[position] = -1;
+	}
+}
+
+void applyActionReference(GameData *gd, const Action *action) {
+	if (action->type == ACTION_TURN_ROTOR) {
+		if (action->target >= 0 && action->target < gd->rotor_count && (action->argument == ROTOR_CLOCKWISE || action->argument == ROTOR_ANTICLOCKWISE))
+			referenceTurnRotor(gd, action->target, action->argument);
+	} else if (action->type == ACTION_RELEASE_BALL) {
+		if (action->target >= 0 && action->target < gd->rotor_count && action->argument >= 0 && action->argument < 4)
+			referenceReleaseBall(gd, action->target, action->argument);
+	} else if (action->type == ACTION_RESET) {
+		// building maps is not part of the tick
+		resetGame(gd);
+	} else if (action->type == ACTION_SPAWN_BALL) {
+		if (action->target >= 0 && action->target < gd->spawn_count && action->argument >= 0 && action->argument <= BALL_TYPE_WHITE)
+			referencePlaceBallInSpawn(gd, action->argument, action->target);
+	}
+}
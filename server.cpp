@@ -0,0 +1,441 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// delta encoding
+//
+// The delta starts with the size of the new snapshot. Then come runs of a
+// 16 bit count of unchanged words, a 16 bit count of changed words and the
+// changed words themselves, XORed with the previous snapshot. Snapshots are
+// always a multiple of 4 bytes long.
+
+static uint32 wordAt(const vector<byte> &buffer, size_t word_index) {
+	uint32 word = 0;
+	if ((word_index + 1) * 4 <= buffer.size()) {
+		memcpy(&word, &buffer[word_index * 4], 4);
+	}
+	return word;
+}
+
+static void appendBytes(vector<byte> *out, const void *data, size_t size) {
+	const byte *bytes = (const byte *)data;
+	out->insert(out->end(), bytes, bytes + size);
+}
+
+int encodeSnapshotDelta(const vector<byte> &previous, const vector<byte> &current, vector<byte> *out) {
+	out->clear();
+	uint32 current_size = (uint32)current.size();
+	appendBytes(out, &current_size, sizeof(current_size));
+
+	size_t word_count = current.size() / 4;
+	size_t i = 0;
+	while (i < word_count) {
+		uint16 skip = 0;
+		while (i < word_count && skip < 0xFFFF && wordAt(current, i) == wordAt(previous, i)) {
+			++skip;
+			++i;
+		}
+		size_t literal_start = i;
+		uint16 literal = 0;
+		while (i < word_count && literal < 0xFFFF && wordAt(current, i) != wordAt(previous, i)) {
+			++literal;
+			++i;
+		}
+		appendBytes(out, &skip, sizeof(skip));
+		appendBytes(out, &literal, sizeof(literal));
+		for (size_t j = literal_start; j < literal_start + literal; ++j) {
+			uint32 word = wordAt(current, j) ^ wordAt(previous, j);
+			appendBytes(out, &word, sizeof(word));
+		}
+	}
+	return (int)out->size();
+}
+
+int applySnapshotDelta(const vector<byte> &previous, const byte *delta, int delta_size, vector<byte> *out) {
+	const byte *end = delta + delta_size;
+	uint32 current_size;
+	if (delta_size < (int)sizeof(current_size))
+		return -1;
+	memcpy(&current_size, delta, sizeof(current_size));
+	delta += sizeof(current_size);
+
+	out->assign(current_size, 0);
+	memcpy(out->data(), previous.data(), min((size_t)current_size, previous.size()));
+
+	size_t word_count = current_size / 4;
+	size_t i = 0;
+	while (i < word_count) {
+		uint16 skip, literal;
+		if (end - delta < 4)
+			return -1;
+		memcpy(&skip, delta, sizeof(skip));
+		memcpy(&literal, delta + 2, sizeof(literal));
+		delta += 4;
+		i += skip;
+		if (i + literal > word_count || end - delta < literal * 4)
+			return -1;
+		for (uint16 j = 0; j < literal; ++j, ++i) {
+			uint32 word;
+			memcpy(&word, delta, sizeof(word));
+			delta += sizeof(word);
+			word ^= wordAt(previous, i);
+			memcpy(&(*out)[i * 4], &word, sizeof(word));
+		}
+	}
+	return 0;
+}
+
+// messages
+
+static void appendMessage(vector<byte> *out, int type, uint32 session, const void *payload, int payload_size, const void *extra = NULL, int extra_size = 0) {
+	NetMessageHeader header;
+	header.size = sizeof(header) + payload_size + extra_size;
+	header.type = type;
+	header.reserved = 0;
+	header.session = session;
+	appendBytes(out, &header, sizeof(header));
+	appendBytes(out, payload, payload_size);
+	appendBytes(out, extra, extra_size);
+}
+
+// sends as much of the buffer as the socket takes right now
+static int flushOutput(Socket s, vector<byte> *output) {
+	size_t sent_total = 0;
+	while (sent_total < output->size()) {
+		int sent = sendSome(s, output->data() + sent_total, (int)(output->size() - sent_total));
+		if (sent < 0)
+			return -1;
+		if (sent == 0)
+			break;
+		sent_total += sent;
+	}
+	output->erase(output->begin(), output->begin() + sent_total);
+	return 0;
+}
+
+// reads everything available, returns -1 if the connection is gone
+static int fillInput(Socket s, vector<byte> *input) {
+	byte buffer[16384];
+	while (true) {
+		int received = receiveSome(s, buffer, sizeof(buffer));
+		if (received < 0)
+			return -1;
+		if (received == 0)
+			return 0;
+		appendBytes(input, buffer, received);
+	}
+}
+
+// returns the size of the next complete message, 0 if there is none yet and -1 if the input is garbage
+static int nextMessageSize(const vector<byte> &input, size_t offset) {
+	NetMessageHeader header;
+	if (input.size() - offset < sizeof(header))
+		return 0;
+	memcpy(&header, &input[offset], sizeof(header));
+	if (header.size < sizeof(header) || header.size > NET_MESSAGE_MAX_SIZE)
+		return -1;
+	if (input.size() - offset < header.size)
+		return 0;
+	return header.size;
+}
+
+// server
+
+static ServerSession *findSession(Server *server, uint32 session_id) {
+	if (session_id == 0 || session_id > server->sessions.size())
+		return NULL;
+	ServerSession *session = &server->sessions[session_id - 1];
+	return session->used ? session : NULL;
+}
+
+static void wakeSession(ServerSession *session) {
+	session->last_active = getCurrentTime();
+	if (session->gd != NULL)
+		return;
+	session->gd = new GameData();
+	newGame(session->gd, session->map_number, session->seed);
+	unpackGame(session->gd, session->snapshot.data(), (int)session->snapshot.size());
+	SDL_Log("Session woke up at tick %u", session->tick);
+}
+
+static void hibernateSession(ServerSession *session) {
+	// the snapshot of the last tick already holds everything needed
+	delete session->gd;
+	session->gd = NULL;
+	SDL_Log("Session hibernated at tick %u (%d bytes)", session->tick, (int)session->snapshot.size());
+}
+
+static int packSession(ServerSession *session, vector<byte> *out) {
+	out->resize(packedGameSize(session->gd));
+	return packGame(session->gd, out->data(), (int)out->size());
+}
+
+static uint32 openSession(Server *server, int map_number, uint32 seed) {
+	if (map_number < 1 || map_number > MAP_COUNT)
+		return 0;
+
+	size_t index = 0;
+	while (index < server->sessions.size() && server->sessions[index].used) {
+		++index;
+	}
+	if (index == server->sessions.size()) {
+		if (index >= SERVER_MAX_SESSIONS) {
+			SDL_Log("Not opening another session, there are %d already", (int)index);
+			return 0;
+		}
+		server->sessions.push_back(ServerSession());
+	}
+
+	ServerSession *session = &server->sessions[index];
+	session->used = true;
+	session->map_number = map_number;
+	session->seed = seed;
+	session->gd = new GameData();
+	session->gd->fixed_point = server->fixed_point;
+	session->gd->line_spacing = server->line_spacing;
+	session->tick = 0;
+	newGame(session->gd, map_number, seed);
+	packSession(session, &session->snapshot);
+	session->last_active = getCurrentTime();
+	SDL_Log("Opened session %d (map %d, seed %u)", (int)index + 1, map_number, seed);
+	return (uint32)index + 1;
+}
+
+static bool isSubscribed(const ServerConnection *connection, uint32 session_id) {
+	return find(connection->subscriptions.begin(), connection->subscriptions.end(), session_id) != connection->subscriptions.end();
+}
+
+static void handleMessage(Server *server, ServerConnection *connection, const byte *message, int size) {
+	NetMessageHeader header;
+	memcpy(&header, message, sizeof(header));
+	const byte *payload = message + sizeof(header);
+	int payload_size = size - sizeof(header);
+
+	if (header.type == MSG_OPEN_SESSION) {
+		NetOpenSession open;
+		if (payload_size < (int)sizeof(open))
+			return;
+		memcpy(&open, payload, sizeof(open));
+		uint32 session_id = 0;
+		if (connection->sessions_opened < SERVER_MAX_SESSIONS_PER_CONNECTION) {
+			session_id = openSession(server, open.map_number, open.seed);
+		}
+		if (session_id != 0) {
+			++connection->sessions_opened;
+			appendMessage(&connection->output, MSG_SESSION_OPENED, session_id, NULL, 0);
+		} else {
+			appendMessage(&connection->output, MSG_ERROR, 0, NULL, 0);
+		}
+		return;
+	}
+
+	ServerSession *session = findSession(server, header.session);
+	if (session == NULL) {
+		appendMessage(&connection->output, MSG_ERROR, header.session, NULL, 0);
+		return;
+	}
+	wakeSession(session);
+
+	if (header.type == MSG_SUBSCRIBE) {
+		if (!isSubscribed(connection, header.session)) {
+			connection->subscriptions.push_back(header.session);
+			connection->keyframes_due.push_back(header.session);
+		}
+	} else if (header.type == MSG_UNSUBSCRIBE) {
+		vector<uint32> *subscriptions = &connection->subscriptions;
+		subscriptions->erase(remove(subscriptions->begin(), subscriptions->end(), header.session), subscriptions->end());
+	} else if (header.type == MSG_TURN_ROTOR || header.type == MSG_RELEASE_BALL) {
+		NetRotorCommand command;
+		if (payload_size < (int)sizeof(command))
+			return;
+		memcpy(&command, payload, sizeof(command));
+		Action action;
+		action.type = header.type == MSG_TURN_ROTOR ? ACTION_TURN_ROTOR : ACTION_RELEASE_BALL;
+		action.target = command.rotor_index;
+		action.argument = command.argument;
+		applyAction(session->gd, &action);
+	} else if (header.type == MSG_RESET) {
+		Action action;
+		action.type = ACTION_RESET;
+		action.target = 0;
+		action.argument = 0;
+		applyAction(session->gd, &action);
+	}
+}
+
+static bool hasSubscribers(const Server *server, uint32 session_id) {
+	for (size_t i = 0; i < server->connections.size(); ++i) {
+		if (isSubscribed(&server->connections[i], session_id))
+			return true;
+	}
+	return false;
+}
+
+static void serviceConnections(Server *server) {
+	// new connections
+	while (true) {
+		Socket s = acceptFrom(server->listener);
+		if (s == SOCKET_NONE)
+			break;
+		server->connections.push_back(ServerConnection());
+		server->connections.back().socket = s;
+		server->connections.back().sessions_opened = 0;
+		SDL_Log("Client connected");
+	}
+
+	// incoming messages
+	for (size_t i = 0; i < server->connections.size(); ++i) {
+		ServerConnection *connection = &server->connections[i];
+		bool gone = fillInput(connection->socket, &connection->input) < 0;
+		size_t offset = 0;
+		while (true) {
+			int size = nextMessageSize(connection->input, offset);
+			if (size < 0) {
+				gone = true;
+				break;
+			} else if (size == 0) {
+				break;
+			}
+			handleMessage(server, connection, &connection->input[offset], size);
+			offset += size;
+		}
+		connection->input.erase(connection->input.begin(), connection->input.begin() + offset);
+		if (gone || flushOutput(connection->socket, &connection->output) < 0) {
+			SDL_Log("Client disconnected");
+			closeSocket(connection->socket);
+			connection->socket = SOCKET_NONE;
+		}
+	}
+
+	// forget closed connections
+	size_t kept = 0;
+	for (size_t i = 0; i < server->connections.size(); ++i) {
+		if (server->connections[i].socket != SOCKET_NONE) {
+			if (kept != i) {
+				swap(server->connections[kept], server->connections[i]);
+			}
+			++kept;
+		}
+	}
+	server->connections.resize(kept);
+}
+
+static void streamSession(Server *server, uint32 session_id) {
+	ServerSession *session = &server->sessions[session_id - 1];
+	for (size_t i = 0; i < server->connections.size(); ++i) {
+		ServerConnection *connection = &server->connections[i];
+		if (!isSubscribed(connection, session_id))
+			continue;
+
+		vector<uint32> *due = &connection->keyframes_due;
+		vector<uint32>::iterator keyframe = find(due->begin(), due->end(), session_id);
+		if (keyframe == due->end() && connection->output.size() > SERVER_MAX_BACKLOG) {
+			// too slow to keep up, start over with a keyframe later
+			due->push_back(session_id);
+		} else if (keyframe != due->end()) {
+			if (connection->output.size() > SERVER_MAX_BACKLOG)
+				continue;
+			NetKeyframe frame;
+			frame.tick = session->tick;
+			frame.map_number = session->map_number;
+			frame.seed = session->seed;
+			appendMessage(&connection->output, MSG_KEYFRAME, session_id, &frame, sizeof(frame), session->snapshot.data(), (int)session->snapshot.size());
+			due->erase(keyframe);
+		} else {
+			NetDelta delta;
+			delta.tick = session->tick;
+			appendMessage(&connection->output, MSG_DELTA, session_id, &delta, sizeof(delta), server->delta.data(), (int)server->delta.size());
+		}
+	}
+}
+
+static void tickSessions(Server *server) {
+	Time now = getCurrentTime();
+	for (size_t i = 0; i < server->sessions.size(); ++i) {
+		ServerSession *session = &server->sessions[i];
+		uint32 session_id = (uint32)i + 1;
+		if (!session->used || session->gd == NULL)
+			continue;
+
+		bool subscribed = hasSubscribers(server, session_id);
+		if (!subscribed && now - session->last_active > SERVER_HIBERNATE_AFTER) {
+			hibernateSession(session);
+			continue;
+		}
+		if (subscribed) {
+			session->last_active = now;
+		}
+
+		progressLogic(session->gd, server->tick_time);
+		++session->tick;
+		if (packSession(session, &server->snapshot) < 0)
+			continue;
+		encodeSnapshotDelta(session->snapshot, server->snapshot, &server->delta);
+		swap(session->snapshot, server->snapshot);
+		streamSession(server, session_id);
+	}
+}
+
+int startServer(Server *server, const char *address, Time tick_time) {
+	server->tick_time = tick_time;
+	server->fixed_point = false;
+	server->line_spacing = false;
+	server->listener = listenOn(address);
+	if (server->listener == SOCKET_NONE)
+		return -1;
+	SDL_Log("Server listening on %s", address);
+	return 0;
+}
+
+void stopServer(Server *server) {
+	for (size_t i = 0; i < server->connections.size(); ++i) {
+		closeSocket(server->connections[i].socket);
+	}
+	server->connections.clear();
+	for (size_t i = 0; i < server->sessions.size(); ++i) {
+		delete server->sessions[i].gd;
+	}
+	server->sessions.clear();
+	closeSocket(server->listener);
+	server->listener = SOCKET_NONE;
+}
+
+void stepServer(Server *server) {
+	serviceConnections(server);
+	tickSessions(server);
+	for (size_t i = 0; i < server->connections.size(); ++i) {
+		flushOutput(server->connections[i].socket, &server->connections[i].output);
+	}
+}
+
+void runServer(Server *server) {
+	vector<Socket> sockets;
+	Time next_tick = getCurrentTime();
+	while (!should_quit) {
+		serviceConnections(server);
+		pollMetrics();
+
+		Time now = getCurrentTime();
+		if (now >= next_tick) {
+			tickSessions(server);
+			for (size_t i = 0; i < server->connections.size(); ++i) {
+				flushOutput(server->connections[i].socket, &server->connections[i].output);
+			}
+			next_tick += server->tick_time;
+			// do not try to catch up after a long stall
+			if (now - next_tick > server->tick_time * 10) {
+				next_tick = now + server->tick_time;
+			}
+		}
+
+		sockets.clear();
+		sockets.push_back(server->listener);
+		for (size_t i = 0; i < server->connections.size(); ++i) {
+			sockets.push_back(server->connections[i].socket);
+		}
+		waitForSockets(sockets.data(), (int)sockets.size(), next_tick - getCurrentTime());
+	}
+}
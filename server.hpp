@@ -0,0 +1,143 @@
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include "logical.hpp"
+#include "net.hpp"
+
+#include <vector>
+
+// Protocol between the headless game server and its viewers and bots.
+//
+// Every message starts with a NetMessageHeader, size includes the header.
+// Clients open sessions, subscribe to them and send rotor commands. The server
+// answers a subscription with a keyframe (a full packed snapshot, see
+// packed.cpp) and from then on sends one delta per tick. A delta is the
+// word-wise difference to the previous snapshot of that session.
+
+#define MSG_OPEN_SESSION   1
+#define MSG_SESSION_OPENED 2
+#define MSG_SUBSCRIBE      3
+#define MSG_UNSUBSCRIBE    4
+#define MSG_TURN_ROTOR     5
+#define MSG_RELEASE_BALL   6
+#define MSG_RESET          7
+#define MSG_KEYFRAME       8
+#define MSG_DELTA          9
+#define MSG_ERROR          10
+
+#define NET_MESSAGE_MAX_SIZE (1 << 24)
+
+struct NetMessageHeader {
+	uint32 size;
+	uint16 type;
+	uint16 reserved;
+	uint32 session;
+};
+
+struct NetOpenSession {
+	int32 map_number;
+	uint32 seed;
+};
+
+struct NetRotorCommand {
+	int32 rotor_index;
+	// direction for MSG_TURN_ROTOR, position for MSG_RELEASE_BALL
+	int32 argument;
+};
+
+// followed by the packed snapshot
+struct NetKeyframe {
+	uint32 tick;
+	int32 map_number;
+	uint32 seed;
+};
+
+// followed by the encoded delta
+struct NetDelta {
+	uint32 tick;
+};
+
+// delta encoding of packed snapshots, used by server and client
+int encodeSnapshotDelta(const std::vector<byte> &previous, const std::vector<byte> &current, std::vector<byte> *out);
+int applySnapshotDelta(const std::vector<byte> &previous, const byte *delta, int delta_size, std::vector<byte> *out);
+
+// server
+
+// sessions without subscribers or commands for this long are hibernated
+#define SERVER_HIBERNATE_AFTER seconds(30)
+// subscribers that fall this far behind get a keyframe once they catch up
+#define SERVER_MAX_BACKLOG (1 << 20)
+// every session costs a GameData and a snapshot per tick while it is awake,
+// opening more than this gets MSG_ERROR
+#define SERVER_MAX_SESSIONS 256
+#define SERVER_MAX_SESSIONS_PER_CONNECTION 16
+
+struct ServerSession {
+	bool used;
+	int map_number;
+	uint32 seed;
+	// NULL while the session is hibernating
+	GameData *gd;
+	// snapshot of the last tick, also holds the state while hibernating
+	std::vector<byte> snapshot;
+	uint32 tick;
+	Time last_active;
+};
+
+struct ServerConnection {
+	Socket socket;
+	std::vector<byte> input;
+	std::vector<byte> output;
+	std::vector<uint32> subscriptions;
+	// sessions this connection needs a full snapshot of
+	std::vector<uint32> keyframes_due;
+	int sessions_opened;
+};
+
+struct Server {
+	Socket listener;
+	Time tick_time;
+	// new sessions run the fixed-point simulation
+	bool fixed_point;
+	// and keep balls on lines apart
+	bool line_spacing;
+	std::vector<ServerSession> sessions;
+	std::vector<ServerConnection> connections;
+	// scratch buffers for the tick
+	std::vector<byte> snapshot;
+	std::vector<byte> delta;
+};
+
+int startServer(Server *, const char *address, Time tick_time);
+void stopServer(Server *);
+void runServer(Server *);
+void stepServer(Server *);
+
+// client
+
+struct Client {
+	Socket socket;
+	std::vector<byte> input;
+	std::vector<byte> output;
+	uint32 session;
+	uint32 tick;
+	bool synchronized;
+	std::vector<byte> snapshot;
+	std::vector<byte> scratch;
+	// mirror of the server state, the map is built from the keyframe
+	GameData *gd;
+};
+
+int connectClient(Client *, const char *address, GameData *gd);
+void disconnectClient(Client *);
+void clientOpenSession(Client *, int map_number, uint32 seed);
+void clientSubscribe(Client *, uint32 session);
+void clientTurnRotor(Client *, int rotor_index, int direction);
+void clientReleaseBall(Client *, int rotor_index, int position);
+void clientReset(Client *);
+// sends the action as the matching message, actions without one are dropped
+void clientSendAction(Client *, const Action *);
+// handles everything the server sent so far, returns -1 when disconnected
+int pollClient(Client *);
+
+#endif // SERVER_HPP_
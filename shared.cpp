@@ -0,0 +1,184 @@
+#include "logical.hpp"
+#include "shared.hpp"
+
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+using namespace std;
+
+static SharedStateHeader *export_header = NULL;
+static size_t export_size = 0;
+static uint64 export_tick = 0;
+static string export_name;
+#if defined(_WIN32)
+static HANDLE export_mapping = NULL;
+#endif
+
+static size_t sharedSlotSize() {
+	size_t size = sizeof(SharedStateSlot) + NBALLS * sizeof(SharedBall) + NROTORS * sizeof(SharedRotor);
+	// keep every slot on its own cache lines
+	return (size + 63) / 64 * 64;
+}
+
+static void *mapSharedMemory(const char *name, size_t size, bool create) {
+#if defined(_WIN32)
+	string mapping_name = string("Local\\") + name;
+	HANDLE mapping;
+	if (create) {
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, mapping_name.c_str());
+	} else {
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mapping_name.c_str());
+	}
+	if (mapping == NULL)
+		return NULL;
+	void *memory = MapViewOfFile(mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+	if (create) {
+		export_mapping = mapping;
+	} else {
+		// the view keeps the mapping alive
+		CloseHandle(mapping);
+	}
+	return memory;
+#else
+	string shm_name = string("/") + name;
+	int fd = shm_open(shm_name.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+	if (fd < 0)
+		return NULL;
+	if (create && ftruncate(fd, size) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if (size == 0) {
+		// readers learn the size from the header
+		SharedStateHeader header;
+		if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != SHARED_STATE_MAGIC) {
+			close(fd);
+			return NULL;
+		}
+		size = sizeof(SharedStateHeader) + (size_t)header.slot_count * header.slot_size;
+	}
+	void *memory = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return memory != MAP_FAILED ? memory : NULL;
+#endif
+}
+
+static void unmapSharedMemory(const void *memory, size_t size) {
+#if defined(_WIN32)
+	UnmapViewOfFile(memory);
+#else
+	munmap((void *)memory, size);
+#endif
+}
+
+int startStateExport(const char *name) {
+	stopStateExport();
+
+	size_t slot_size = sharedSlotSize();
+	export_size = sizeof(SharedStateHeader) + SHARED_STATE_SLOTS * slot_size;
+	void *memory = mapSharedMemory(name, export_size, true);
+	if (memory == NULL) {
+		SDL_Log("Creating shared memory %s failed", name);
+		return -1;
+	}
+	memset(memory, 0, export_size);
+
+	export_header = (SharedStateHeader *)memory;
+	export_header->version = SHARED_STATE_VERSION;
+	export_header->slot_count = SHARED_STATE_SLOTS;
+	export_header->slot_size = (uint32)slot_size;
+	export_header->max_balls = NBALLS;
+	export_header->max_rotors = NROTORS;
+	export_header->latest_tick.store(0);
+	// readers check the magic last
+	atomic_thread_fence(memory_order_release);
+	export_header->magic = SHARED_STATE_MAGIC;
+	export_tick = 0;
+	export_name = name;
+	SDL_Log("Exporting game state to shared memory %s (%d bytes)", name, (int)export_size);
+	return 0;
+}
+
+void stopStateExport() {
+	if (export_header == NULL)
+		return;
+	unmapSharedMemory(export_header, export_size);
+	export_header = NULL;
+#if defined(_WIN32)
+	CloseHandle(export_mapping);
+	export_mapping = NULL;
+#else
+	shm_unlink((string("/") + export_name).c_str());
+#endif
+}
+
+void exportState(const GameData *gd) {
+	if (export_header == NULL)
+		return;
+
+	uint64 tick = ++export_tick;
+	SharedStateSlot *slot = (SharedStateSlot *)getSharedSlot(export_header, tick);
+	uint64 sequence = slot->sequence.load(memory_order_relaxed);
+	slot->sequence.store(sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	SharedBall *balls = (SharedBall *)getSharedBalls(slot);
+	int ball_count = 0;
+	for (int i = 0; i < NBALLS; ++i) {
+		const Ball *ball = &gd->balls[i];
+		if (ball->type == BALL_TYPE_NONE)
+			continue;
+		SharedBall *shared = &balls[ball_count++];
+		getBallPosition(gd, i, &shared->x, &shared->y);
+		shared->index = i;
+		shared->target = ball->connector.target;
+		shared->type = ball->type;
+		shared->connector_type = ball->connector.type;
+		shared->rotor_position = ball->connector.type == CONNECTOR_ROTOR ? ball->connector.rotor.position : -1;
+		shared->reserved = 0;
+	}
+
+	SharedRotor *rotors = (SharedRotor *)getSharedRotors(export_header, slot);
+	int rotors_destroyed = 0;
+	for (int i = 0; i < gd->rotor_count; ++i) {
+		const Rotor *rotor = &gd->rotors[i];
+		SharedRotor *shared = &rotors[i];
+		shared->x = rotor->x;
+		shared->y = rotor->y;
+		for (int pos = 0; pos < 4; ++pos) {
+			shared->ball_types[pos] = (int8)((rotor->slots >> (8 * pos)) & 0xFF) - 1;
+		}
+		shared->destroyed = rotor->destroyed;
+		rotors_destroyed += rotor->destroyed;
+	}
+
+	slot->tick = tick;
+	slot->time = gd->time;
+	slot->ball_count = ball_count;
+	slot->rotor_count = gd->rotor_count;
+	slot->rotors_destroyed = rotors_destroyed;
+
+	slot->sequence.store(sequence + 2, memory_order_release);
+	export_header->latest_tick.store(tick, memory_order_release);
+}
+
+const SharedStateHeader *openSharedState(const char *name) {
+	const SharedStateHeader *header = (const SharedStateHeader *)mapSharedMemory(name, 0, false);
+	if (header == NULL || header->magic != SHARED_STATE_MAGIC || header->version != SHARED_STATE_VERSION) {
+		SDL_Log("Opening shared memory %s failed", name);
+		return NULL;
+	}
+	return header;
+}
+
+void closeSharedState(const SharedStateHeader *header) {
+	unmapSharedMemory(header, sizeof(SharedStateHeader) + (size_t)header->slot_count * header->slot_size);
+}
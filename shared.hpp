@@ -0,0 +1,104 @@
+#ifndef SHARED_HPP_
+#define SHARED_HPP_
+
+#include "std_types.hpp"
+
+#include <atomic>
+
+// Layout of the shared memory the game publishes its state into, once per
+// tick. External tools can include this header on its own.
+//
+// The memory starts with a SharedStateHeader followed by slot_count slots of
+// slot_size bytes each. A slot is a SharedStateSlot followed by max_balls
+// SharedBall and max_rotors SharedRotor entries, of which only the first
+// ball_count and rotor_count are valid. Tick n is written to slot
+// n % slot_count.
+//
+// Every slot is protected by a seqlock: the writer makes the sequence odd
+// before it touches the slot and even again afterwards. A reader checks the
+// sequence before and after reading the slot in place; if it was odd or has
+// changed, the data was torn and the reader has to try again. The writer never
+// waits for readers.
+
+#define SHARED_STATE_MAGIC   0x4C474353
+#define SHARED_STATE_VERSION 1
+#define SHARED_STATE_SLOTS   4
+
+struct SharedStateHeader {
+	uint32 magic;
+	uint32 version;
+	uint32 slot_count;
+	uint32 slot_size;
+	uint32 max_balls;
+	uint32 max_rotors;
+	// number of the last completely written tick, 0 if there is none yet
+	std::atomic<uint64> latest_tick;
+};
+
+struct SharedStateSlot {
+	std::atomic<uint64> sequence;
+	uint64 tick;
+	int64 time;
+	uint32 ball_count;
+	uint32 rotor_count;
+	uint32 rotors_destroyed;
+	uint32 reserved;
+};
+
+struct SharedBall {
+	float x;
+	float y;
+	uint32 index;
+	int32 target;
+	int8 type;
+	int8 connector_type;
+	int8 rotor_position;
+	int8 reserved;
+};
+
+struct SharedRotor {
+	float x;
+	float y;
+	// ball type in each position, -1 if empty
+	int8 ball_types[4];
+	uint8 destroyed;
+	uint8 reserved[3];
+};
+
+inline const SharedStateSlot *getSharedSlot(const SharedStateHeader *header, uint64 tick) {
+	const byte *slots = (const byte *)header + sizeof(SharedStateHeader);
+	return (const SharedStateSlot *)(slots + (tick % header->slot_count) * header->slot_size);
+}
+
+inline const SharedBall *getSharedBalls(const SharedStateSlot *slot) {
+	return (const SharedBall *)(slot + 1);
+}
+
+inline const SharedRotor *getSharedRotors(const SharedStateHeader *header, const SharedStateSlot *slot) {
+	return (const SharedRotor *)(getSharedBalls(slot) + header->max_balls);
+}
+
+// reader side: returns the slot of the latest tick and remembers its sequence,
+// or NULL if nothing has been published yet or the writer is busy with it
+inline const SharedStateSlot *beginSharedRead(const SharedStateHeader *header, uint64 *sequence) {
+	uint64 tick = header->latest_tick.load(std::memory_order_acquire);
+	if (tick == 0)
+		return NULL;
+	const SharedStateSlot *slot = getSharedSlot(header, tick);
+	*sequence = slot->sequence.load(std::memory_order_acquire);
+	if (*sequence & 1)
+		return NULL;
+	return slot;
+}
+
+// reader side: true if the slot was not touched while it was read
+inline bool endSharedRead(const SharedStateSlot *slot, uint64 sequence) {
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+// map the shared memory of a running game for reading, NULL on failure
+const SharedStateHeader *openSharedState(const char *name);
+void closeSharedState(const SharedStateHeader *);
+
+#endif // SHARED_HPP_
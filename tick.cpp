@@ -0,0 +1,126 @@
+#include "logical.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+// The parallel tick gives exactly the same result as progressLogic.
+//
+// Moving a ball along its line or through free space only touches that ball,
+// so the workers do it for all balls at once. Everything else changes shared
+// state: reaching the end of a line, leaving a spawn or inserter, decaying.
+// The workers only collect those balls and afterwards the calling thread
+// handles them in the order of their ball index, the same order in which
+// progressLogic would have handled them. Balls waiting in rotors are skipped
+// without being looked at, see updateBallBucket.
+//
+// Handling a ball can add a new ball to a spawn. If it gets a higher index
+// than the ball being handled, progressLogic would still reach it during the
+// same tick, so it is handled here as well.
+
+#define TICK_BALLS_PER_CHUNK 1024
+
+struct TickJob {
+	GameData *gd;
+	Time t;
+	int chunk_count;
+};
+
+// balls each chunk could not handle on its own, sorted by index
+static vector<int> chunk_pending[NBALLS / TICK_BALLS_PER_CHUNK + 1];
+
+static void moveBallsInChunk(void *context, int chunk_index) {
+	TickJob *job = (TickJob *)context;
+	GameData *gd = job->gd;
+	vector<int> *pending = &chunk_pending[chunk_index];
+	pending->clear();
+
+	int begin = chunk_index * TICK_BALLS_PER_CHUNK;
+	int end = min(begin + TICK_BALLS_PER_CHUNK, NBALLS);
+	// balls in rotors are not even looked at, the buckets do not change until the workers are done
+	for (int i = findMovingBall(gd, begin, end); i < end; i = findMovingBall(gd, i + 1, end)) {
+		int connector_type = gd->balls[i].connector.type;
+		if (connector_type == CONNECTOR_LINE) {
+			if (moveBallAlongLine(gd, i, job->t)) {
+				pending->push_back(i);
+			}
+		} else if (connector_type == CONNECTOR_FREE) {
+			if (moveFreeBall(gd, i)) {
+				pending->push_back(i);
+			}
+		} else {
+			pending->push_back(i);
+		}
+	}
+}
+
+static void finishBall(GameData *gd, int ball_index, Time t) {
+	int connector_type = gd->balls[ball_index].connector.type;
+	if (connector_type == CONNECTOR_LINE) {
+		finishBallOnLine(gd, ball_index);
+	} else if (connector_type == CONNECTOR_FREE) {
+		emitEvent(gd, EVENT_BALL_DECAYED, ball_index, -1, gd->balls[ball_index].type);
+		SDL_Log("Ball %i decayed", ball_index);
+		removeBall(gd, ball_index);
+	} else {
+		progressBall(gd, ball_index, t);
+	}
+}
+
+void progressLogicParallel(GameData *gd, Time t) {
+	// with spacing every ball on a line depends on the one in front of it
+	if (getWorkerCount() <= 1 || gd->line_spacing) {
+		progressLogic(gd, t);
+		return;
+	}
+
+	Time start = getCurrentTime();
+	TickJob job;
+	job.gd = gd;
+	job.t = t;
+	job.chunk_count = (NBALLS + TICK_BALLS_PER_CHUNK - 1) / TICK_BALLS_PER_CHUNK;
+	runOnWorkers(job.chunk_count, moveBallsInChunk, &job);
+
+	// balls added during this tick that still need to be progressed
+	priority_queue<int, vector<int>, greater<int> > added;
+
+	int chunk_index = 0;
+	size_t pending_index = 0;
+	while (true) {
+		while (chunk_index < job.chunk_count && pending_index == chunk_pending[chunk_index].size()) {
+			++chunk_index;
+			pending_index = 0;
+		}
+
+		int ball_index;
+		bool is_new;
+		if (chunk_index < job.chunk_count && (added.empty() || chunk_pending[chunk_index][pending_index] < added.top())) {
+			ball_index = chunk_pending[chunk_index][pending_index++];
+			is_new = false;
+		} else if (!added.empty()) {
+			ball_index = added.top();
+			added.pop();
+			is_new = true;
+		} else {
+			break;
+		}
+
+		gd->ball_last_added = -1;
+		if (is_new) {
+			progressBall(gd, ball_index, t);
+		} else {
+			finishBall(gd, ball_index, t);
+		}
+		// at most one ball gets added while handling another one
+		if (gd->ball_last_added > ball_index) {
+			added.push(gd->ball_last_added);
+		}
+	}
+
+	gd->time += t;
+	countMetric(&metrics.ticks);
+	observeDuration(&metrics.tick_duration, getCurrentTime() - start);
+}
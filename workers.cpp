@@ -0,0 +1,104 @@
+#include "workers.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static vector<thread> threads;
+static mutex pool_mutex;
+static condition_variable start_condition;
+static condition_variable done_condition;
+
+// the job that is currently being run
+static WorkerTask job_task = nullptr;
+static void *job_context = nullptr;
+static int job_task_count = 0;
+static atomic<int> job_next_task(0);
+static int job_generation = 0;
+static int job_busy_threads = 0;
+static bool stopping = false;
+
+static void runTasks() {
+	while (true) {
+		int task_index = job_next_task.fetch_add(1);
+		if (task_index >= job_task_count)
+			break;
+		job_task(job_context, task_index);
+	}
+}
+
+static void workerMain() {
+	int generation = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(pool_mutex);
+			start_condition.wait(lock, [&] { return stopping || job_generation != generation; });
+			if (stopping)
+				return;
+			generation = job_generation;
+		}
+
+		runTasks();
+
+		{
+			lock_guard<mutex> lock(pool_mutex);
+			if (--job_busy_threads == 0) {
+				done_condition.notify_one();
+			}
+		}
+	}
+}
+
+void startWorkers(int thread_count) {
+	stopWorkers();
+	stopping = false;
+	for (int i = 1; i < thread_count; ++i) {
+		threads.push_back(thread(workerMain));
+	}
+}
+
+void stopWorkers() {
+	{
+		lock_guard<mutex> lock(pool_mutex);
+		stopping = true;
+	}
+	start_condition.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	threads.clear();
+}
+
+int getWorkerCount() {
+	return (int)threads.size() + 1;
+}
+
+void runOnWorkers(int task_count, WorkerTask task, void *context) {
+	// small jobs are not worth waking anybody up for
+	if (threads.empty() || task_count <= 1) {
+		for (int i = 0; i < task_count; ++i) {
+			task(context, i);
+		}
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(pool_mutex);
+		job_task = task;
+		job_context = context;
+		job_task_count = task_count;
+		job_next_task = 0;
+		job_busy_threads = (int)threads.size();
+		++job_generation;
+	}
+	start_condition.notify_all();
+
+	runTasks();
+
+	unique_lock<mutex> lock(pool_mutex);
+	done_condition.wait(lock, [] { return job_busy_threads == 0; });
+}
@@ -0,0 +1,18 @@
+#ifndef WORKERS_HPP_
+#define WORKERS_HPP_
+
+#include "std_types.hpp"
+
+// a task gets the context it was started with and its index
+typedef void (*WorkerTask)(void *context, int task_index);
+
+// start a fixed pool of threads, the calling thread counts as one of them
+void startWorkers(int thread_count);
+void stopWorkers();
+int getWorkerCount();
+
+// run task_count tasks on the pool and wait until all of them are done,
+// only one thread at a time may start jobs
+void runOnWorkers(int task_count, WorkerTask task, void *context);
+
+#endif // WORKERS_HPP_